@@ -0,0 +1,94 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+/*
+ * Access to the shaders and images a tutorial needs. The files are linked into
+ * the executable by the embed tool (see the Makefile), so loading them costs
+ * no file system access and works from any working directory.
+ * Setting CGLCORE_ASSET_DIR reads the files from that directory instead, which
+ * is handy when editing shaders without rebuilding.
+ */
+
+struct Asset {
+    const char* name;
+    const unsigned char* data;
+    unsigned int size;
+};
+
+// the table of embedded assets, terminated by an entry with a null name
+// (defined in the tutorialXX_assets.cpp file generated by the embed tool)
+extern const Asset embeddedAssets[];
+
+// the bytes of an asset, always followed by a terminating 0 so that shader
+// sources can be used as C strings
+class AssetData {
+
+public:
+
+    AssetData(const std::string& name) : bytes(nullptr), length(0), owned(false) {
+        const char* dir = getenv("CGLCORE_ASSET_DIR");
+        if (dir == nullptr) {
+            for (const Asset* a = embeddedAssets; a->name != nullptr; a++) {
+                if (name == a->name) {
+                    bytes = a->data;
+                    length = a->size;
+                    return;
+                }
+            }
+        }
+        std::string filename = dir != nullptr ? std::string(dir) + "/" + name : name;
+        readFile(filename.c_str());
+    }
+
+    AssetData(AssetData&& other) : bytes(other.bytes), length(other.length), owned(other.owned) {
+        other.bytes = nullptr;
+        other.owned = false;
+    }
+
+    ~AssetData() {
+        if (owned) {
+            free((void*) bytes);
+        }
+    }
+
+    bool valid() const { return bytes != nullptr; }
+    const unsigned char* data() const { return bytes; }
+    const char* text() const { return (const char*) bytes; }
+    unsigned int size() const { return length; }
+
+private:
+
+    AssetData(const AssetData&) = delete;
+    AssetData& operator=(const AssetData&) = delete;
+
+    void readFile(const char* filename) {
+        struct stat st;
+        // we need to read as binary, not text, otherwise we are screwed on Windows
+        FILE* file = fopen(filename, "rb");
+        if (file == nullptr || fstat(fileno(file), &st) != 0) {
+            printf("Could not read asset %s\n", filename);
+            if (file != nullptr) {
+                fclose(file);
+            }
+            return;
+        }
+        unsigned char* content = (unsigned char*) malloc(st.st_size + 1);
+        length = fread(content, 1, st.st_size, file);
+        content[length] = 0;
+        fclose(file);
+        bytes = content;
+        owned = true;
+    }
+
+    const unsigned char* bytes;
+    unsigned int length;
+    bool owned;
+};
+
+#endif
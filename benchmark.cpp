@@ -0,0 +1,142 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+ * Benchmark of the scenes of the tutorials, rendered without a window (see
+ * headless.h) so that it runs the same on a desktop and on a CI machine:
+ *
+ *     benchmark [-frames 200] [-warmup 30] [-sizes 640x480,1920x1080] [-o results.json] [scene...]
+ *
+ * runs each scene, or only those whose names contain one of the given ones,
+ * at each size, in a process of its own and one after the other. The
+ * reports of the runs, with the distributions of the CPU submit time, the
+ * GPU time and the wall time of their frames, are gathered into a JSON array
+ * with one run per line, so that the results of two builds compare with diff.
+ */
+
+struct Scene {
+    const char* name;
+    const char* command;
+};
+
+const Scene scenes[] = {
+    { "triangle grid", "./tutorial01" },
+    { "cube", "./tutorial04" },
+    { "torus gouraud", "./tutorial06" },
+    { "torus phong", "./tutorial07" },
+    { "flat sphere", "./tutorial08" },
+    { "earth day night", "./tutorial09" },
+    { "cloud dissolve", "./tutorial10" },
+};
+
+bool selected(const Scene& scene, const std::vector<std::string>& filters) {
+    if (filters.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < filters.size(); i++) {
+        if (strstr(scene.name, filters[i].c_str()) != nullptr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the first line of the file, without its end
+std::string readLine(const char* path) {
+    std::string line;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return line;
+    }
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+        line += buffer;
+        if (!line.empty() && line[line.size() - 1] == '\n') {
+            line.erase(line.size() - 1);
+            break;
+        }
+    }
+    fclose(file);
+    return line;
+}
+
+int main(int argc, char** argv) {
+
+    int frames = 200;
+    int warmup = 30;
+    std::string sizes = "640x480,1280x720,1920x1080";
+    const char* outputPath = nullptr;
+    std::vector<std::string> filters;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-sizes") == 0 && i + 1 < argc) {
+            sizes = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else {
+            filters.push_back(argv[i]);
+        }
+    }
+
+    FILE* output = outputPath != nullptr ? fopen(outputPath, "w") : stdout;
+    if (output == nullptr) {
+        printf("Cannot write %s\n", outputPath);
+        return 1;
+    }
+    char reportPath[] = "/tmp/benchmarkXXXXXX";
+    int reportFile = mkstemp(reportPath);
+    if (reportFile < 0) {
+        printf("Cannot create a temporary file\n");
+        return 1;
+    }
+    close(reportFile);
+
+    int failures = 0;
+    bool first = true;
+    fprintf(output, "[\n");
+    for (size_t i = 0; i < sizeof(scenes) / sizeof(scenes[0]); i++) {
+        if (!selected(scenes[i], filters)) {
+            continue;
+        }
+        size_t start = 0;
+        while (start < sizes.size()) {
+            size_t end = sizes.find(',', start);
+            if (end == std::string::npos) {
+                end = sizes.size();
+            }
+            std::string size = sizes.substr(start, end - start);
+            start = end + 1;
+
+            // the scenes print to the standard output, which may be the results
+            char command[1024];
+            snprintf(command, sizeof(command), "%s -headless %d %s -warmup %d -report %s 1>&2",
+                scenes[i].command, frames, size.c_str(), warmup, reportPath);
+            fprintf(stderr, "%s at %s\n", scenes[i].name, size.c_str());
+            unlink(reportPath);
+            std::string report;
+            if (system(command) == 0) {
+                report = readLine(reportPath);
+            }
+            if (report.size() < 2 || report[0] != '{') {
+                fprintf(stderr, "%s failed\n", command);
+                failures++;
+                continue;
+            }
+            fprintf(output, "%s  { \"scene\": \"%s\", %s", first ? "" : ",\n", scenes[i].name, report.c_str() + 2);
+            first = false;
+        }
+    }
+    fprintf(output, "\n]\n");
+    unlink(reportPath);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return failures == 0 ? 0 : 1;
+}
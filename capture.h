@@ -0,0 +1,349 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <png.h>
+#include "globjects.h"
+#include "pixels.h"
+#include "tracer.h"
+
+/*
+ * Recording of the frames a tutorial renders, without stalling it:
+ *
+ *     CGLCORE_CAPTURE=session.y4m ./tutorial09
+ *     CGLCORE_CAPTURE=frame%05d.png ./tutorial09
+ *
+ * Each frame is read back into one of a ring of pixel pack buffers, with a
+ * fence behind it, so glReadPixels returns at once and the copy happens
+ * while the GPU goes on with the next frames. A frame whose fence has passed
+ * is mapped and handed to a worker thread, which writes it from the mapping
+ * as a raw YUV 4:2:0 video frame (Y4M, which ffmpeg and most players read)
+ * or as a PNG file of its own; the GL thread unmaps the buffer once the
+ * worker is done with it. When the GPU or the worker falls behind and no
+ * buffer of the ring is free, frames are dropped and counted rather than
+ * waited for.
+ */
+
+class FrameCapture {
+
+public:
+
+    explicit FrameCapture(int slotCount = 4) : slots(slotCount), width(0), height(0), fps(60), file(nullptr),
+        frameCount(0), framesWritten(0), framesDropped(0), captureSeconds(0.0), writeSeconds(0.0), stopping(false), failed(false) {}
+
+    ~FrameCapture() {
+        // without a context, only the worker can still be stopped
+        stopWorker();
+        closeFile();
+    }
+
+    // starts capturing the width x height frames of the default framebuffer:
+    // a path ending with .y4m is a video, any other one a printf pattern for
+    // the PNG files, given the frame number
+    bool start(const std::string& path, int width, int height, int fps = 60) {
+        this->path = path;
+        this->width = width;
+        this->height = height;
+        this->fps = fps;
+        video = path.size() > 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+        if (video) {
+            // the chroma planes have half the resolution in both directions
+            if (width % 2 != 0 || height % 2 != 0) {
+                printf("Y4M capture needs an even frame size, not %d x %d\n", width, height);
+                return false;
+            }
+            file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                printf("Could not open %s for writing\n", path.c_str());
+                return false;
+            }
+            fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+        }
+        size_t size = (size_t) width * height * 4;
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].buffer = gl::Buffer::create(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        worker = std::thread(&FrameCapture::run, this);
+        printf("Capturing %d x %d frames to %s\n", width, height, path.c_str());
+        return true;
+    }
+
+    // starts capturing to the path in CGLCORE_CAPTURE, if it is set
+    bool startFromEnvironment(int width, int height) {
+        const char* path = getenv("CGLCORE_CAPTURE");
+        return path != nullptr && start(path, width, height);
+    }
+
+    bool capturing() const {
+        return worker.joinable();
+    }
+
+    // queues the readback of the frame just rendered; call it before swapping
+    void capture() {
+        if (!capturing()) {
+            return;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        collect(false);
+        Slot* slot = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < slots.size() && slot == nullptr; i++) {
+                if (slots[i].state == SLOT_FREE) {
+                    slot = &slots[i];
+                }
+            }
+        }
+        if (slot == nullptr) {
+            // the GPU or the worker is a whole ring behind
+            framesDropped++;
+        } else {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer.getId());
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot->frame = frameCount;
+            slot->state = SLOT_READING;
+            reading.push_back(slot);
+        }
+        frameCount++;
+        captureSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // writes the frames still in flight and stops capturing; the context
+    // must be current
+    void finish() {
+        if (!capturing()) {
+            return;
+        }
+        while (!reading.empty()) {
+            collect(true);
+        }
+        stopWorker();
+        collect(false);
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i].buffer.reset();
+        }
+        closeFile();
+        printf("%s: %d frames written, %d dropped, %.3f ms per frame on the GL thread, %.2f ms per frame on the worker\n",
+            path.c_str(), framesWritten, framesDropped, frameCount > 0 ? captureSeconds * 1000.0 / frameCount : 0.0,
+            framesWritten > 0 ? writeSeconds * 1000.0 / framesWritten : 0.0);
+    }
+
+    int getFramesWritten() const { return framesWritten; }
+    int getFramesDropped() const { return framesDropped; }
+
+private:
+
+    enum SlotState {
+        SLOT_FREE,
+        // glReadPixels is queued, the fence tells when it is done
+        SLOT_READING,
+        // mapped, the worker writes it out
+        SLOT_WRITING,
+        // the worker is done, the GL thread can unmap it
+        SLOT_WRITTEN
+    };
+
+    struct Slot {
+        Slot() : state(SLOT_FREE), fence(nullptr), pixels(nullptr), frame(0) {}
+        gl::Buffer buffer;
+        SlotState state;
+        GLsync fence;
+        const unsigned char* pixels;
+        int frame;
+    };
+
+    std::vector<Slot> slots;
+    std::string path;
+    bool video;
+    int width;
+    int height;
+    int fps;
+    FILE* file;
+    int frameCount;
+    int framesWritten;
+    int framesDropped;
+    double captureSeconds;
+    double writeSeconds;
+    // the slots in SLOT_READING, oldest first
+    std::deque<Slot*> reading;
+
+    // shared with the worker, under the mutex: the slots to write, in
+    // order, and the state of the slots it is writing
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Slot*> queue;
+    bool stopping;
+    bool failed;
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // hands the readbacks that are complete to the worker, in the order of
+    // the frames, and frees the buffers it is done with; wait blocks until
+    // the oldest readback is done
+    void collect(bool wait) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[i];
+            if (slot.state == SLOT_WRITTEN) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer.getId());
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                slot.state = SLOT_FREE;
+            }
+        }
+        while (!reading.empty()) {
+            Slot& slot = *reading.front();
+            GLuint64 timeout = wait ? 1000000000ull : 0;
+            GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                // the later ones are not done either
+                return;
+            }
+            wait = false;
+            reading.pop_front();
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer.getId());
+            slot.pixels = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t) width * height * 4, GL_MAP_READ_BIT);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.state = SLOT_WRITING;
+            queue.push_back(&slot);
+            condition.notify_one();
+        }
+    }
+
+    void stopWorker() {
+        if (!worker.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_one();
+        worker.join();
+    }
+
+    void closeFile() {
+        if (file != nullptr) {
+            if (fclose(file) != 0) {
+                failed = true;
+            }
+            file = nullptr;
+        }
+        if (failed) {
+            printf("Could not write %s\n", path.c_str());
+            failed = false;
+        }
+    }
+
+    // the worker: writes the queued frames, then the remaining ones once
+    // stopping is set
+    void run() {
+        Tracer::instance().setThreadName("capture");
+        std::vector<unsigned char> row((size_t) width * 4);
+        for (;;) {
+            Slot* slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                slot = queue.front();
+                queue.pop_front();
+            }
+            Tracer::Scope trace("write frame");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool written = slot->pixels != nullptr && (video ? writeVideoFrame(slot->pixels) : writePng(slot->pixels, slot->frame, row));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot->state = SLOT_WRITTEN;
+                slot->pixels = nullptr;
+                failed = failed || !written;
+                if (written) {
+                    framesWritten++;
+                }
+                writeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+    }
+
+    // converts the frame to BT.601 limited range YUV with chroma averaged
+    // over 2 x 2 pixels; GL rows go bottom up, video rows top down
+    bool writeVideoFrame(const unsigned char* pixels) {
+        std::vector<unsigned char> planes((size_t) width * height * 3 / 2);
+        unsigned char* yPlane = planes.data();
+        unsigned char* uPlane = yPlane + (size_t) width * height;
+        unsigned char* vPlane = uPlane + (size_t) width * height / 4;
+        size_t stride = (size_t) width * 4;
+        for (int y = 0; y < height; y += 2) {
+            const unsigned char* top = pixels + (height - 1 - y) * stride;
+            const unsigned char* bottom = top - stride;
+            unsigned char* yTop = yPlane + (size_t) y * width;
+            unsigned char* yBottom = yTop + width;
+            for (int x = 0; x < width; x += 2) {
+                const unsigned char* p[4] = { top + x * 4, top + x * 4 + 4, bottom + x * 4, bottom + x * 4 + 4 };
+                int r = 0, g = 0, b = 0;
+                for (int i = 0; i < 4; i++) {
+                    r += p[i][0];
+                    g += p[i][1];
+                    b += p[i][2];
+                    unsigned char luma = (66 * p[i][0] + 129 * p[i][1] + 25 * p[i][2] + 128 + (16 << 8)) >> 8;
+                    (i < 2 ? yTop : yBottom)[x + (i & 1)] = luma;
+                }
+                size_t c = (size_t) (y / 2) * (width / 2) + x / 2;
+                uPlane[c] = (-38 * r - 74 * g + 112 * b + 512 + (128 << 10)) >> 10;
+                vPlane[c] = (112 * r - 94 * g - 18 * b + 512 + (128 << 10)) >> 10;
+            }
+        }
+        return fwrite("FRAME\n", 1, 6, file) == 6 && fwrite(planes.data(), 1, planes.size(), file) == planes.size();
+    }
+
+    bool writePng(const unsigned char* pixels, int frame, std::vector<unsigned char>& row) {
+        char name[1024];
+        snprintf(name, sizeof(name), path.c_str(), frame);
+        FILE* out = fopen(name, "wb");
+        if (out == nullptr) {
+            return false;
+        }
+        png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        png_infop pngInfo = png_create_info_struct(png);
+        bool written = false;
+        if (setjmp(png_jmpbuf(png)) == 0) {
+            png_init_io(png, out);
+            // the frames are meant to be watched, fast beats small
+            png_set_compression_level(png, 1);
+            png_set_filter(png, 0, PNG_FILTER_SUB);
+            png_set_IHDR(png, pngInfo, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+            png_write_info(png, pngInfo);
+            // the alpha of the framebuffer means nothing on screen
+            for (int y = height - 1; y >= 0; y--) {
+                packRGBAToRGB(pixels + (size_t) y * width * 4, row.data(), width);
+                png_write_row(png, row.data());
+            }
+            png_write_end(png, pngInfo);
+            written = true;
+        }
+        png_destroy_write_struct(&png, &pngInfo);
+        return fclose(out) == 0 && written;
+    }
+};
+
+#endif
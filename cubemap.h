@@ -0,0 +1,201 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "tracer.h"
+
+/*
+ * Resampling of equirectangular images (longitude along x, latitude along y,
+ * north at the top, like the earth maps) into the 6 faces of a cube map. A
+ * sphere then samples its texture with the direction from its center, which
+ * needs no texture coordinates, and has no seam where the longitude wraps
+ * around nor any pinching at the poles.
+ *
+ * The faces follow the GL cube map layout: face i is
+ * GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, and its rows go from t = 0 to t = 1.
+ * The longitude and latitude of each texel come from SSE2 approximations of
+ * atan2, four texels at a time, and the rows of the faces are spread over
+ * threads.
+ */
+
+// the size of the faces for an image of the given width: the equator is 4
+// faces around, rounded up to a power of two so that all the mip levels halve
+inline int cubeFaceSize(int width) {
+    int size = 1;
+    while (size * 4 < width) {
+        size *= 2;
+    }
+    return size;
+}
+
+// the direction through the point (a, b) of a face, a and b going from -1 to
+// 1 along s and t, as in table 8.19 of the OpenGL 3.3 specification
+inline void cubeFaceDirection(int face, float a, float b, float& x, float& y, float& z) {
+    switch (face) {
+    case 0: x = 1.0f; y = -b; z = -a; break;
+    case 1: x = -1.0f; y = -b; z = a; break;
+    case 2: x = a; y = 1.0f; z = b; break;
+    case 3: x = a; y = -1.0f; z = -b; break;
+    case 4: x = a; y = -b; z = 1.0f; break;
+    default: x = -a; y = -b; z = -1.0f; break;
+    }
+}
+
+#ifdef __SSE2__
+// atan2 of four pairs, within 1e-5 radians, from a polynomial fit of atan
+// on [0, 1] and the symmetries of the quadrants
+inline __m128 atan2SSE2(__m128 y, __m128 x) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 ax = _mm_andnot_ps(signMask, x);
+    __m128 ay = _mm_andnot_ps(signMask, y);
+    __m128 mn = _mm_min_ps(ax, ay);
+    // the max is only 0 at the poles, where any longitude will do
+    __m128 mx = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f));
+    __m128 a = _mm_div_ps(mn, mx);
+    __m128 s = _mm_mul_ps(a, a);
+    __m128 r = _mm_set1_ps(-0.01172120f);
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.05265332f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.11643287f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.19354346f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(-0.33262347f));
+    r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(0.99997726f));
+    r = _mm_mul_ps(r, a);
+    // atan(y/x) = pi/2 - atan(x/y) above the diagonal
+    __m128 steep = _mm_cmpgt_ps(ay, ax);
+    r = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(_mm_set1_ps(1.57079637f), r)), _mm_andnot_ps(steep, r));
+    // the left half plane is the mirror image of the right one
+    __m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+    r = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(_mm_set1_ps(3.14159274f), r)), _mm_andnot_ps(left, r));
+    // and the lower half plane of the upper one
+    return _mm_or_ps(r, _mm_and_ps(y, signMask));
+}
+#endif
+
+// bilinear sample of an RGBA8 equirectangular image at (px, py) in texels,
+// wrapping around horizontally and clamping vertically
+inline void sampleEquirect(const unsigned char* src, int width, int height, float px, float py, unsigned char* out) {
+    float fx = floorf(px);
+    float fy = floorf(py);
+    int wx = (int) ((px - fx) * 256.0f);
+    int wy = (int) ((py - fy) * 256.0f);
+    int x0 = ((int) fx % width + width) % width;
+    int x1 = x0 + 1 == width ? 0 : x0 + 1;
+    int y0 = std::max(0, std::min((int) fy, height - 1));
+    int y1 = std::max(0, std::min((int) fy + 1, height - 1));
+    const unsigned char* row0 = src + (size_t) y0 * width * 4;
+    const unsigned char* row1 = src + (size_t) y1 * width * 4;
+    for (int c = 0; c < 4; c++) {
+        int top = row0[x0 * 4 + c] * (256 - wx) + row0[x1 * 4 + c] * wx;
+        int bottom = row1[x0 * 4 + c] * (256 - wx) + row1[x1 * 4 + c] * wx;
+        out[c] = (top * (256 - wy) + bottom * wy + 32768) >> 16;
+    }
+}
+
+#ifdef __SSE2__
+// the same for four positions at once: the coordinates are computed in
+// vectors, then each texel blends its 4 neighbours with 16 bit arithmetic
+inline void sampleEquirectSSE2(const unsigned char* src, int width, int height, __m128 px, __m128 py, unsigned char* out) {
+    // px is above -1 and py above -0.5, so that truncation after the offsets is floor
+    __m128i ix = _mm_cvttps_epi32(_mm_add_ps(px, _mm_set1_ps((float) width)));
+    __m128i iy = _mm_cvttps_epi32(_mm_add_ps(py, _mm_set1_ps(1.0f)));
+    __m128 fx = _mm_sub_ps(_mm_add_ps(px, _mm_set1_ps((float) width)), _mm_cvtepi32_ps(ix));
+    __m128 fy = _mm_sub_ps(_mm_add_ps(py, _mm_set1_ps(1.0f)), _mm_cvtepi32_ps(iy));
+    int xs[4], ys[4], wxs[4], wys[4];
+    _mm_storeu_si128((__m128i*) xs, ix);
+    _mm_storeu_si128((__m128i*) ys, iy);
+    _mm_storeu_si128((__m128i*) wxs, _mm_cvttps_epi32(_mm_mul_ps(fx, _mm_set1_ps(256.0f))));
+    _mm_storeu_si128((__m128i*) wys, _mm_cvttps_epi32(_mm_mul_ps(fy, _mm_set1_ps(256.0f))));
+    const __m128i zero = _mm_setzero_si128();
+    for (int k = 0; k < 4; k++) {
+        int x0 = xs[k] % width;
+        int x1 = x0 + 1 == width ? 0 : x0 + 1;
+        int y0 = std::max(0, std::min(ys[k] - 1, height - 1));
+        int y1 = std::min(ys[k], height - 1);
+        const unsigned int* row0 = (const unsigned int*) (src + (size_t) y0 * width * 4);
+        const unsigned int* row1 = (const unsigned int*) (src + (size_t) y1 * width * 4);
+        // the left texels in the low half, the right ones in the high half
+        __m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(row0[x0]), _mm_cvtsi32_si128(row0[x1])), zero);
+        __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128(row1[x0]), _mm_cvtsi32_si128(row1[x1])), zero);
+        __m128i wy = _mm_set1_epi16(wys[k]);
+        // (top * (256 - wy) + bottom * wy) / 256, as top + (bottom - top) * wy / 256
+        __m128i column = _mm_add_epi16(_mm_slli_epi16(top, 8), _mm_mullo_epi16(_mm_sub_epi16(bottom, top), wy));
+        column = _mm_srli_epi16(_mm_add_epi16(column, _mm_set1_epi16(128)), 8);
+        __m128i weights = _mm_setr_epi16(256 - wxs[k], 256 - wxs[k], 256 - wxs[k], 256 - wxs[k], wxs[k], wxs[k], wxs[k], wxs[k]);
+        __m128i blended = _mm_mullo_epi16(column, weights);
+        blended = _mm_add_epi16(blended, _mm_srli_si128(blended, 8));
+        blended = _mm_srli_epi16(_mm_add_epi16(blended, _mm_set1_epi16(128)), 8);
+        *(int*) (out + k * 4) = _mm_cvtsi128_si32(_mm_packus_epi16(blended, zero));
+    }
+}
+#endif
+
+// fills rows [first, last) of the 6 x size rows of the faces, face after face
+inline void equirectToCubeRows(const unsigned char* src, int width, int height, int size, unsigned char* faces, int first, int last) {
+    Tracer::Scope trace("resample rows");
+    // the texture coordinates the sphere used were u = lon / 2pi + 0.5 and
+    // v = 0.5 - lat / pi; in texels of the source, whose centers are at + 0.5
+    const float toX = width / (2.0f * 3.14159265f);
+    const float toY = height / 3.14159265f;
+    const float originX = width * 0.5f - 0.5f;
+    const float originY = height * 0.5f - 0.5f;
+    for (int row = first; row < last; row++) {
+        int face = row / size;
+        float b = 2.0f * (row % size + 0.5f) / size - 1.0f;
+        unsigned char* out = faces + (size_t) row * size * 4;
+        // along a row the direction is an affine function of a
+        float x0, y0, z0, x1, y1, z1;
+        cubeFaceDirection(face, 0.0f, b, x0, y0, z0);
+        cubeFaceDirection(face, 1.0f, b, x1, y1, z1);
+        int i = 0;
+#ifdef __SSE2__
+        const __m128 step = _mm_set1_ps(8.0f / size);
+        __m128 a = _mm_setr_ps(1.0f / size - 1.0f, 3.0f / size - 1.0f, 5.0f / size - 1.0f, 7.0f / size - 1.0f);
+        for (; i + 4 <= size; i += 4) {
+            __m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_mul_ps(a, _mm_set1_ps(x1 - x0)));
+            __m128 y = _mm_add_ps(_mm_set1_ps(y0), _mm_mul_ps(a, _mm_set1_ps(y1 - y0)));
+            __m128 z = _mm_add_ps(_mm_set1_ps(z0), _mm_mul_ps(a, _mm_set1_ps(z1 - z0)));
+            __m128 horizontal = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+            __m128 lon = atan2SSE2(y, x);
+            __m128 lat = atan2SSE2(z, horizontal);
+            __m128 px = _mm_add_ps(_mm_mul_ps(lon, _mm_set1_ps(toX)), _mm_set1_ps(originX));
+            __m128 py = _mm_sub_ps(_mm_set1_ps(originY), _mm_mul_ps(lat, _mm_set1_ps(toY)));
+            sampleEquirectSSE2(src, width, height, px, py, out + i * 4);
+            a = _mm_add_ps(a, step);
+        }
+#endif
+        for (; i < size; i++) {
+            float a = 2.0f * (i + 0.5f) / size - 1.0f;
+            float x = x0 + a * (x1 - x0);
+            float y = y0 + a * (y1 - y0);
+            float z = z0 + a * (z1 - z0);
+            float lon = atan2f(y, x);
+            float lat = atan2f(z, sqrtf(x * x + y * y));
+            sampleEquirect(src, width, height, lon * toX + originX, originY - lat * toY, out + i * 4);
+        }
+    }
+}
+
+// resamples a width x height RGBA8 equirectangular image into 6 faces of
+// size x size RGBA8 texels, stored one after the other in faces
+inline void equirectToCube(const unsigned char* src, int width, int height, int size, unsigned char* faces) {
+    int rows = 6 * size;
+    int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, rows);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(equirectToCubeRows, src, width, height, size, faces,
+            rows * i / threadCount, rows * (i + 1) / threadCount));
+    }
+    equirectToCubeRows(src, width, height, size, faces, 0, rows / threadCount);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+#endif
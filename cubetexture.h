@@ -0,0 +1,376 @@
+#ifndef CUBETEXTURE_H
+#define CUBETEXTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <GL/glew.h>
+#include "assets.h"
+#include "globjects.h"
+#include "tracer.h"
+#include "image.h"
+#include "workerpool.h"
+#include "texcache.h"
+#include "texcompress.h"
+#include "cubemap.h"
+
+/*
+ * A cube map texture made from an equirectangular image, so that a sphere
+ * can sample it with its directions, see cubemap.h:
+ *
+ *     CubeTexture earth("earth_day.jpg", BLOCK_BC1);
+ *     earth.load(pool);
+ *     ...
+ *     CubeTexture* textures[] = { &earth };
+ *     uploadWhenReady(textures, 1);
+ *     earth.bind(0);
+ *
+ * load() starts decoding the image on a worker of the pool and returns;
+ * the faces are uploaded once they are ready, in the order the workers finish
+ * them with uploadWhenReady(). The faces and their mip levels are cached on
+ * disk for the next runs, see texcache.h, compressed for the GPU when a
+ * block format is given, see texcompress.h.
+ */
+
+class CubeTexture {
+
+public:
+
+    // blockFormat asks for the faces to be compressed for the GPU, maxLevel
+    // limits the mip chain, by default it goes all the way down to 1x1
+    CubeTexture(const std::string& s, BlockFormat blockFormat = BLOCK_NONE, int maxLevel = 1000) {
+        imageFile = s;
+        this->blockFormat = blockFormat;
+        this->maxLevel = maxLevel;
+    }
+
+    // starts loading the image: the header is read and the texture storage
+    // allocated here on the GL thread, then a worker of the pool decodes the
+    // pixels and resamples them into the faces while the GL thread goes on;
+    // upload() completes the texture
+    void load(WorkerPool& pool) {
+        Tracer::Scope trace("CubeTexture::load");
+        start = std::chrono::steady_clock::now();
+        imageData.reset(new AssetData(imageFile));
+        decoder.reset(new ImageDecoder());
+        if (!decoder->open(imageData->data(), imageData->size())) {
+            printf("Could not read %s\n", imageFile.c_str());
+            releaseSources();
+            return;
+        }
+        width = decoder->getWidth();
+        height = decoder->getHeight();
+        faceSize = cubeFaceSize(width);
+
+        // when the sphere is small on screen, sampling the full size faces
+        // thrashes the texture cache: trilinear filtering reads from the mip
+        // level matching the on screen size instead
+        levels = std::min(gl::Texture::mipLevels(faceSize, faceSize), maxLevel + 1);
+        texture = gl::Texture::create(GL_TEXTURE_CUBE_MAP);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        compressedFormat = compressedInternalFormat();
+        texture.storage2D(levels, internalFormat(), faceSize, faceSize);
+
+        sourceHash = hashBytes(imageData->data(), imageData->size());
+        if (loadCached()) {
+            releaseSources();
+            return;
+        }
+        size_t size = (size_t) faceSize * faceSize * 4 * 6;
+        if (compressedFormat != 0) {
+            // the encoder reads the faces back, so they are made in memory,
+            // and the worker compresses the whole mip chain as well
+            pending = pool.submit([this, size]() {
+                std::vector<unsigned char> faces(size);
+                bool decoded = decodeFaces(faces.data());
+                if (decoded) {
+                    compressLevels(faces.data());
+                }
+                return decoded;
+            });
+        } else {
+            // the faces are written straight into a buffer owned by the driver,
+            // which copies them into the texture without another pass over the
+            // pixels. The mapping stays valid until the GL thread unmaps it,
+            // the worker only writes through the pointer
+            pixelBuffer = gl::Buffer::create(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            unsigned char* faces = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pending = pool.submit([this, faces]() {
+                return faces != nullptr && decodeFaces(faces);
+            });
+        }
+    }
+
+    // true while a load() has not been completed by upload()
+    bool loading() {
+        return pending.valid();
+    }
+
+    // true when the worker is done with the image, waiting up to timeoutMillis
+    bool ready(int timeoutMillis = 0) {
+        return pending.valid() && pending.wait_for(std::chrono::milliseconds(timeoutMillis)) == std::future_status::ready;
+    }
+
+    // hands the faces to GL, waiting for the worker if it is not done yet
+    void upload() {
+        if (!pending.valid()) {
+            return;
+        }
+        Tracer::Scope trace("CubeTexture::upload");
+        texture.bind();
+        bool decoded = pending.get();
+        if (compressedFormat != 0) {
+            int size = faceSize;
+            for (int level = 0; decoded && level < levels; level++) {
+                uploadLevel(level, size, compressedLevels[level].data(), compressedLevels[level].size());
+                size = std::max(1, size / 2);
+            }
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer.getId());
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            if (decoded) {
+                uploadLevel(0, faceSize, 0, (size_t) faceSize * faceSize * 4 * 6);
+                glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pixelBuffer.reset();
+        }
+        if (!decoded) {
+            printf("Could not decode %s\n", imageFile.c_str());
+            releaseSources();
+            texture.reset();
+            return;
+        }
+        printf("%s: %d x %d decoded in %.1f ms, resampled into 6 faces of %d x %d in %.1f ms, uploaded %.1f ms after the load started\n",
+            imageFile.c_str(), width, height, decodeMillis, faceSize, faceSize, resampleMillis, millisSince(start));
+        writeCache();
+        releaseSources();
+    }
+
+    // binds the texture to a texture unit; the binds are counted per frame
+    void bind(int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        texture.bind();
+        binds()++;
+    }
+
+    // the binds of all the cube textures, which the loops reset every frame
+    static int& binds() {
+        static int count = 0;
+        return count;
+    }
+
+    void destroy() {
+        if (loading()) {
+            upload();
+        }
+        texture.reset();
+    }
+
+    GLuint getId() {
+        return texture.getId();
+    }
+
+private:
+
+    std::string imageFile;
+    BlockFormat blockFormat;
+    int maxLevel;
+    gl::Texture texture;
+    std::chrono::steady_clock::time_point start;
+    GLenum compressedFormat;
+    int width;
+    int height;
+    int faceSize;
+    int levels;
+
+    // the state of a load while in progress
+    std::unique_ptr<AssetData> imageData;
+    std::unique_ptr<ImageDecoder> decoder;
+    std::future<bool> pending;
+    gl::Buffer pixelBuffer;
+    // the 6 faces of each level, one after the other
+    std::vector<std::vector<unsigned char> > compressedLevels;
+    uint64_t sourceHash;
+    double decodeMillis;
+    double resampleMillis;
+
+    static double millisSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void releaseSources() {
+        decoder.reset();
+        imageData.reset();
+        compressedLevels.clear();
+    }
+
+    // decodes the image and resamples it into the 6 faces, on a worker
+    bool decodeFaces(unsigned char* faces) {
+        Tracer::Scope trace("CubeTexture::decodeFaces");
+        std::vector<unsigned char> pixels((size_t) width * height * 4);
+        bool decoded = decoder->decode(pixels.data(), 4, false);
+        decodeMillis = millisSince(start);
+        if (decoded) {
+            std::chrono::steady_clock::time_point resampleStart = std::chrono::steady_clock::now();
+            equirectToCube(pixels.data(), width, height, faceSize, faces);
+            resampleMillis = millisSince(resampleStart);
+        }
+        return decoded;
+    }
+
+    // the GL format for blockFormat, or 0 when the texture stays uncompressed
+    // because it was not asked for or the driver cannot sample it
+    GLenum compressedInternalFormat() {
+        if (blockFormat == BLOCK_BC1 && GLEW_EXT_texture_compression_s3tc) {
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        }
+        if (blockFormat == BLOCK_BC4 && (GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc)) {
+            return GL_COMPRESSED_RED_RGTC1;
+        }
+        if (blockFormat == BLOCK_BC3 && GLEW_EXT_texture_compression_s3tc) {
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }
+        return 0;
+    }
+
+    GLenum internalFormat() {
+        return compressedFormat != 0 ? compressedFormat : GL_RGBA8;
+    }
+
+    // uploads the 6 faces of a mip level, stored one after the other, from
+    // memory or from the bound pixel unpack buffer
+    void uploadLevel(int level, int size, const void* faces, size_t levelSize) {
+        size_t faceBytes = levelSize / 6;
+        for (int face = 0; face < 6; face++) {
+            const unsigned char* pixels = (const unsigned char*) faces + faceBytes * face;
+            if (compressedFormat != 0) {
+                glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+                    compressedFormat, faceBytes, pixels);
+            } else {
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+                    GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            }
+        }
+    }
+
+    // the faces are cached rather than the image, under a name of their own
+    std::string cachePath() {
+        return textureCachePath(imageFile + ".cube");
+    }
+
+    // fills the texture from the cache written by an earlier run, if there is
+    // one for its image, uploading straight from the mapped file
+    bool loadCached() {
+        std::string path = cachePath();
+        TextureCacheFile cache;
+        if (!cache.open(path, sourceHash) || cache.getInternalFormat() != internalFormat()
+                || cache.getWidth() != faceSize || cache.getHeight() != faceSize || cache.getLevels() != levels
+                || cache.getFaces() != 6) {
+            return false;
+        }
+        int size = faceSize;
+        for (int level = 0; level < levels; level++) {
+            uploadLevel(level, size, cache.getLevel(level), cache.getLevelSize(level));
+            size = std::max(1, size / 2);
+        }
+        printf("%s: 6 faces of %d x %d read from %s in %.1f ms\n", imageFile.c_str(), faceSize, faceSize, path.c_str(), millisSince(start));
+        return true;
+    }
+
+    // keeps the mip chain for the next runs: compressed levels are still in
+    // memory, the others are read back from the levels glGenerateMipmap made
+    void writeCache() {
+        std::vector<std::vector<unsigned char> > levelData;
+        if (compressedFormat != 0) {
+            levelData.swap(compressedLevels);
+        } else {
+            levelData.resize(levels);
+            int size = faceSize;
+            for (int level = 0; level < levels; level++) {
+                size_t faceBytes = (size_t) size * size * 4;
+                levelData[level].resize(faceBytes * 6);
+                for (int face = 0; face < 6; face++) {
+                    glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA, GL_UNSIGNED_BYTE,
+                        levelData[level].data() + faceBytes * face);
+                }
+                size = std::max(1, size / 2);
+            }
+        }
+        // a cache that cannot be written is only missed by the next run
+        TextureCacheFile::write(cachePath(), sourceHash, internalFormat(), faceSize, faceSize, 6, levelData);
+    }
+
+    // glGenerateMipmap cannot write compressed levels, so the mip chain of
+    // each face is filtered on the CPU and every level is compressed before
+    // the upload
+    void compressLevels(const unsigned char* faces) {
+        Tracer::Scope trace("CubeTexture::compressLevels");
+        size_t compressedSize = 0;
+        size_t uncompressedSize = 0;
+        double encodeSeconds = 0.0;
+        compressedLevels.assign(levels, std::vector<unsigned char>());
+        for (int face = 0; face < 6; face++) {
+            const unsigned char* pixels = faces + (size_t) faceSize * faceSize * 4 * face;
+            std::vector<unsigned char> level;
+            std::vector<unsigned char> nextLevel;
+            int size = faceSize;
+            for (int i = 0; i < levels; i++) {
+                size_t faceBytes = blockCompressedSize(blockFormat, size, size);
+                compressedLevels[i].resize(faceBytes * 6);
+                std::chrono::steady_clock::time_point encodeStart = std::chrono::steady_clock::now();
+                blockCompress(blockFormat, pixels, size, size, compressedLevels[i].data() + faceBytes * face);
+                encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+                compressedSize += faceBytes;
+                uncompressedSize += (size_t) size * size * 4;
+                if (i + 1 < levels) {
+                    nextLevel.resize((size_t) std::max(1, size / 2) * std::max(1, size / 2) * 4);
+                    downsampleRGBA(pixels, size, size, nextLevel.data());
+                    level.swap(nextLevel);
+                    pixels = level.data();
+                    size = std::max(1, size / 2);
+                }
+            }
+        }
+        printf("%s: %s, 6 faces of %d levels encoded in %.1f ms (%.0f MPixels/s), %.2f MB instead of %.2f MB\n",
+            imageFile.c_str(), blockFormat == BLOCK_BC1 ? "BC1" : blockFormat == BLOCK_BC4 ? "BC4" : "BC3", levels, encodeSeconds * 1000.0,
+            uncompressedSize / 4 / encodeSeconds / 1e6, compressedSize / 1048576.0, uncompressedSize / 1048576.0);
+    }
+};
+
+// completes the loads of the given textures in the order their workers finish
+// them, so the first frame waits for the slowest image rather than for the
+// sum of all of them
+inline void uploadWhenReady(CubeTexture** textures, int count) {
+    Tracer::Scope trace("uploadWhenReady");
+    for (;;) {
+        CubeTexture* waiting = nullptr;
+        bool uploaded = false;
+        for (int i = 0; i < count; i++) {
+            if (textures[i]->ready()) {
+                textures[i]->upload();
+                uploaded = true;
+            } else if (textures[i]->loading() && waiting == nullptr) {
+                waiting = textures[i];
+            }
+        }
+        if (waiting == nullptr) {
+            return;
+        }
+        if (!uploaded) {
+            waiting->ready(1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+ * Build tool that links shaders and images into a tutorial executable.
+ *
+ *     embed tutorial09_assets.cpp tutorial09.vert tutorial09.frag earth_day.jpg
+ *
+ * writes a source file in which the assembler pulls each file into the
+ * read-only data section with .incbin, followed by the embeddedAssets table
+ * declared in assets.h. The files are not parsed, so the images stay
+ * compressed in the executable and are decoded from memory at runtime.
+ */
+
+const char* fileName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash == nullptr ? path : slash + 1;
+}
+
+// writes s escaped for a string literal nested nesting strings deep: in the
+// assembler string of .incbin, itself in a C string, a quote or a backslash
+// needs 3 backslashes in front of it
+void writeEscaped(FILE* out, const char* s, int nesting) {
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            for (int i = 0; i < (1 << nesting) - 1; i++) {
+                fputc('\\', out);
+            }
+        }
+        fputc(*s, out);
+    }
+}
+
+// a line break cannot be written into either string
+bool hasControlCharacter(const char* s) {
+    for (; *s != '\0'; s++) {
+        if ((unsigned char) *s < 0x20) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 2) {
+        printf("usage: %s output.cpp [file...]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[1], "w");
+    if (out == nullptr) {
+        printf("Could not open %s for writing\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "// generated by embed, do not edit\n");
+    fprintf(out, "#include \"assets.h\"\n\n");
+
+    long* sizes = (long*) malloc(argc * sizeof(long));
+    for (int i = 2; i < argc; i++) {
+        char path[PATH_MAX];
+        struct stat st;
+        if (realpath(argv[i], path) == nullptr || stat(path, &st) != 0) {
+            printf("Could not find %s\n", argv[i]);
+            fclose(out);
+            remove(argv[1]);
+            return 1;
+        }
+        if (hasControlCharacter(path) || hasControlCharacter(fileName(argv[i]))) {
+            printf("Cannot embed %s, its path has a control character\n", argv[i]);
+            fclose(out);
+            remove(argv[1]);
+            return 1;
+        }
+        sizes[i] = st.st_size;
+        // each asset is followed by a 0 so that text files can be used as C strings
+        fprintf(out, "__asm__(\n");
+        fprintf(out, "    \".section .rodata\\n\"\n");
+        fprintf(out, "    \".balign 16\\n\"\n");
+        fprintf(out, "    \"embeddedAsset%d:\\n\"\n", i - 2);
+        fprintf(out, "    \".incbin \\\"");
+        writeEscaped(out, path, 2);
+        fprintf(out, "\\\"\\n\"\n");
+        fprintf(out, "    \".byte 0\\n\"\n");
+        fprintf(out, "    \".previous\\n\");\n");
+        fprintf(out, "extern \"C\" const unsigned char embeddedAsset%d[];\n\n", i - 2);
+    }
+
+    fprintf(out, "const Asset embeddedAssets[] = {\n");
+    for (int i = 2; i < argc; i++) {
+        fprintf(out, "    { \"");
+        writeEscaped(out, fileName(argv[i]), 1);
+        fprintf(out, "\", embeddedAsset%d, %ld },\n", i - 2, sizes[i]);
+    }
+    fprintf(out, "    { nullptr, nullptr, 0 }\n");
+    fprintf(out, "};\n");
+    free(sizes);
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,159 @@
+#ifndef FRAMECLOCK_H
+#define FRAMECLOCK_H
+
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+/*
+ * Timing of the frames from monotonic clocks. clock() measures the CPU time
+ * of the process, which stops while it waits for vsync or the GPU and speeds
+ * up with worker threads, so animations driven by it ran at the speed of the
+ * CPU load, and its ticks are too coarse for a frame.
+ *
+ * FrameClock keeps the last frames in a ring:
+ *
+ *     frameClock.beginFrame();   // before the work of the frame
+ *     ...
+ *     frameClock.beginSwap();    // right before swapping the buffers
+ *     SDL_GL_SwapBuffers();
+ *     frameClock.endFrame();     // right after
+ *
+ * and gives percentiles over them of the frame time (from one endFrame() to
+ * the next, what the user sees), of the CPU time the rendering thread spent
+ * on the frame, and of the time the swap blocked.
+ */
+
+// wall time in milliseconds, from an arbitrary origin
+inline long currentTimeMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class FrameClock {
+
+public:
+
+    enum Series {
+        FRAME_TIME,
+        CPU_TIME,
+        SWAP_TIME
+    };
+
+    // keeps the last capacity frames, 4 seconds at 60 Hz by default
+    explicit FrameClock(int capacity = 240) : samples(capacity), next(0), sampleCount(0), frameCount(0), ended(false),
+        cpuStart(0.0) {}
+
+    void beginFrame() {
+        frameStart = std::chrono::steady_clock::now();
+        swapStart = frameStart;
+        cpuStart = threadCpuMillis();
+    }
+
+    void beginSwap() {
+        swapStart = std::chrono::steady_clock::now();
+    }
+
+    void endFrame() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        Sample& sample = samples[next];
+        // the first frame has no previous one to count from
+        sample.frame = millisBetween(ended ? frameEnd : frameStart, now);
+        sample.cpu = threadCpuMillis() - cpuStart;
+        sample.swap = millisBetween(swapStart, now);
+        frameEnd = now;
+        ended = true;
+        next = (next + 1) % samples.size();
+        sampleCount = std::min(sampleCount + 1, (int) samples.size());
+        frameCount++;
+    }
+
+    // the time under which p percent of the frames in the ring were, in ms
+    double percentile(Series series, double p) const {
+        if (sampleCount == 0) {
+            return 0.0;
+        }
+        std::vector<float> values(sampleCount);
+        for (int i = 0; i < sampleCount; i++) {
+            const Sample& sample = samples[i];
+            values[i] = series == FRAME_TIME ? sample.frame : series == CPU_TIME ? sample.cpu : sample.swap;
+        }
+        size_t rank = std::min((size_t) (p / 100.0 * sampleCount), values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+    // how far the values in the ring spread around their mean, in ms; for
+    // the frame time, the jitter the percentiles only hint at
+    double deviation(Series series) const {
+        if (sampleCount == 0) {
+            return 0.0;
+        }
+        double sum = 0.0;
+        double squares = 0.0;
+        for (int i = 0; i < sampleCount; i++) {
+            const Sample& sample = samples[i];
+            double value = series == FRAME_TIME ? sample.frame : series == CPU_TIME ? sample.cpu : sample.swap;
+            sum += value;
+            squares += value * value;
+        }
+        double mean = sum / sampleCount;
+        return sqrt(std::max(0.0, squares / sampleCount - mean * mean));
+    }
+
+    // the frames since the clock was created
+    long getFrameCount() const { return frameCount; }
+
+    // the average rate over the frames in the ring
+    double getFramesPerSecond() const {
+        double total = 0.0;
+        for (int i = 0; i < sampleCount; i++) {
+            total += samples[i].frame;
+        }
+        return total > 0.0 ? sampleCount * 1000.0 / total : 0.0;
+    }
+
+    // "frame p50 16.7 p95 17.1 p99 18.0 sd 0.4 ms, cpu 2.1 ms, swap 14.2 ms",
+    // the last two being medians
+    std::string summary() const {
+        char text[256];
+        snprintf(text, sizeof(text), "frame p50 %.1f p95 %.1f p99 %.1f sd %.1f ms, cpu %.1f ms, swap %.1f ms",
+            percentile(FRAME_TIME, 50), percentile(FRAME_TIME, 95), percentile(FRAME_TIME, 99),
+            deviation(FRAME_TIME), percentile(CPU_TIME, 50), percentile(SWAP_TIME, 50));
+        return text;
+    }
+
+private:
+
+    struct Sample {
+        float frame;
+        float cpu;
+        float swap;
+    };
+
+    std::vector<Sample> samples;
+    int next;
+    int sampleCount;
+    long frameCount;
+    bool ended;
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point swapStart;
+    std::chrono::steady_clock::time_point frameEnd;
+    double cpuStart;
+
+    static float millisBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        return std::chrono::duration<float, std::milli>(end - start).count();
+    }
+
+    // the CPU time of the calling thread only, the workers have their own
+    static double threadCpuMillis() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+    }
+};
+
+#endif
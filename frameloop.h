@@ -0,0 +1,166 @@
+#ifndef FRAMELOOP_H
+#define FRAMELOOP_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+
+/*
+ * Pacing of the main loops at a target frame rate, without polling:
+ *
+ *     frameLoop.parseArguments(argc, argv);   // takes -fps N out
+ *     frameLoop.start(displayFd);
+ *     while (!done) {
+ *         ...                                  // handle the pending events
+ *         if (frameLoop.wait()) {
+ *             render();
+ *         }
+ *     }
+ *
+ * wait() sleeps in epoll_wait() on a periodic timerfd, whose deadlines stay
+ * on a fixed grid whatever the frames cost, and on the connection to the
+ * display server. The events of the server wake it up right away: it returns
+ * false so that they are handled, then waits again for the deadline, which
+ * is still pending. Deadlines missed while a frame ran late are skipped
+ * rather than caught up, and counted.
+ *
+ * Toolkits such as Xlib and SDL read the connection into a queue of their
+ * own, which must be drained before waiting; events queued during a swap are
+ * then handled with the next frame. -fps 0 renders as fast as the loop can,
+ * and wait() always returns true.
+ */
+
+class FrameLoop {
+
+public:
+
+    explicit FrameLoop(int framesPerSecond = 60) : framesPerSecond(framesPerSecond), epollFd(-1), timerFd(-1),
+        framesMissed(0) {}
+
+    ~FrameLoop() {
+        stop();
+    }
+
+    // takes -fps N out of the arguments
+    void parseArguments(int& argc, char** argv) {
+        int kept = 1;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-fps") == 0 && i + 1 < argc) {
+                framesPerSecond = std::max(0, atoi(argv[++i]));
+            } else {
+                argv[kept++] = argv[i];
+            }
+        }
+        argc = kept;
+        argv[argc] = nullptr;
+    }
+
+    // starts the timer; displayFd, the connection to the display server, is
+    // watched for events unless negative
+    bool start(int displayFd) {
+        stop();
+        if (framesPerSecond <= 0) {
+            return true;
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epollFd < 0 || timerFd < 0 || !watch(timerFd) || (displayFd >= 0 && !watch(displayFd))) {
+            printf("Cannot pace the frames: %s\n", strerror(errno));
+            stop();
+            return false;
+        }
+        long period = 1000000000L / framesPerSecond;
+        itimerspec spec;
+        spec.it_interval.tv_sec = period / 1000000000L;
+        spec.it_interval.tv_nsec = period % 1000000000L;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(timerFd, 0, &spec, nullptr);
+        return true;
+    }
+
+    void stop() {
+        if (timerFd >= 0) {
+            close(timerFd);
+            timerFd = -1;
+        }
+        if (epollFd >= 0) {
+            close(epollFd);
+            epollFd = -1;
+        }
+    }
+
+    // true when the next frame is due, false when the display has events
+    // to handle first
+    bool wait() {
+        if (timerFd < 0) {
+            return true;
+        }
+        for (;;) {
+            epoll_event events[2];
+            int count = epoll_wait(epollFd, events, 2, -1);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return true;
+            }
+            bool due = false;
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.fd != timerFd) {
+                    // the timer stays readable for the next wait()
+                    return false;
+                }
+                due = true;
+            }
+            uint64_t expirations = 0;
+            if (due && read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                framesMissed += expirations - 1;
+                return true;
+            }
+        }
+    }
+
+    int getFramesPerSecond() const { return framesPerSecond; }
+
+    // the deadlines skipped because a frame was late
+    long getFramesMissed() const { return framesMissed; }
+
+private:
+
+    int framesPerSecond;
+    int epollFd;
+    int timerFd;
+    long framesMissed;
+
+    FrameLoop(const FrameLoop&) = delete;
+    FrameLoop& operator=(const FrameLoop&) = delete;
+
+    bool watch(int fd) {
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+};
+
+#ifdef _SDL_syswm_h
+// the connection to the X server that SDL reads its events from, -1 when
+// SDL does not run on X11
+inline int sdlDisplayFd() {
+    SDL_SysWMinfo info;
+    SDL_VERSION(&info.version);
+    if (SDL_GetWMInfo(&info) <= 0 || info.subsystem != SDL_SYSWM_X11) {
+        return -1;
+    }
+    return ConnectionNumber(info.info.x11.display);
+}
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef GLOBJECTS_H
+#define GLOBJECTS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <GL/glew.h>
+
+/*
+ * Move-only owners for OpenGL objects. Each wrapper deletes the object it holds
+ * when it goes out of scope or is reset, so a scene frees everything it created
+ * by dropping its objects. This has to happen while the GL context is current,
+ * which is why the tutorials release their objects before tearing the window down.
+ */
+
+namespace gl {
+
+inline bool checkShaderCompileStatus(GLuint shaderId) {
+    GLint compileStatus;
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
+    if (compileStatus == GL_FALSE) {
+        GLint infoLogLength;
+        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
+        printf("Shader compilation failed...\n");
+        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
+        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
+        log[infoLogLength] = 0;
+        printf("%s", log);
+        free(log);
+    }
+    return compileStatus == GL_TRUE;
+}
+
+inline bool checkProgramLinkStatus(GLuint programId) {
+    GLint linkStatus;
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
+    if (linkStatus == GL_FALSE) {
+        GLint infoLogLength;
+        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
+        printf("Program link failed...\n");
+        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
+        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
+        log[infoLogLength] = 0;
+        printf("%s", log);
+        free(log);
+    }
+    return linkStatus == GL_TRUE;
+}
+
+// the part common to all wrappers: owning a GL name, released with Traits::destroy
+template <class Traits>
+class Object {
+
+public:
+
+    Object() : id(0) {}
+
+    Object(Object&& other) : id(other.id) {
+        other.id = 0;
+    }
+
+    Object& operator=(Object&& other) {
+        if (this != &other) {
+            reset();
+            id = other.id;
+            other.id = 0;
+        }
+        return *this;
+    }
+
+    ~Object() {
+        reset();
+    }
+
+    void reset() {
+        if (id != 0) {
+            Traits::destroy(id);
+            id = 0;
+        }
+    }
+
+    GLuint getId() const { return id; }
+    bool valid() const { return id != 0; }
+
+protected:
+
+    GLuint id;
+
+private:
+
+    Object(const Object&) = delete;
+    Object& operator=(const Object&) = delete;
+};
+
+struct BufferTraits { static void destroy(GLuint id) { glDeleteBuffers(1, &id); } };
+struct TextureTraits { static void destroy(GLuint id) { glDeleteTextures(1, &id); } };
+struct ShaderTraits { static void destroy(GLuint id) { glDeleteShader(id); } };
+struct ProgramTraits { static void destroy(GLuint id) { glDeleteProgram(id); } };
+struct VertexArrayTraits { static void destroy(GLuint id) { glDeleteVertexArrays(1, &id); } };
+struct QueryTraits { static void destroy(GLuint id) { glDeleteQueries(1, &id); } };
+
+class Buffer : public Object<BufferTraits> {
+
+public:
+
+    // creates a buffer bound to target and fills it with size bytes of data,
+    // which the caller may free as soon as this returns
+    static Buffer create(GLenum target, GLsizeiptr size, const void* data, GLenum usage = GL_STATIC_DRAW) {
+        Buffer buffer;
+        glGenBuffers(1, &buffer.id);
+        glBindBuffer(target, buffer.id);
+        glBufferData(target, size, data, usage);
+        return buffer;
+    }
+};
+
+class Texture : public Object<TextureTraits> {
+
+public:
+
+    Texture() : target(0) {}
+
+    // creates a texture and leaves it bound to target
+    static Texture create(GLenum target) {
+        Texture texture;
+        texture.target = target;
+        glGenTextures(1, &texture.id);
+        glBindTexture(target, texture.id);
+        return texture;
+    }
+
+    void bind() const { glBindTexture(target, id); }
+    GLenum getTarget() const { return target; }
+
+    // allocates immutable storage for the given number of mip levels, or
+    // defines the levels one by one on drivers without ARB_texture_storage
+    void storage2D(GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height) {
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(target, levels, internalFormat, width, height);
+        } else {
+            // a cube map has 6 faces of width x height to allocate per level
+            GLenum firstTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+            GLenum lastTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_NEGATIVE_Z : target;
+            for (GLsizei level = 0; level < levels; level++) {
+                for (GLenum face = firstTarget; face <= lastTarget; face++) {
+                    glTexImage2D(face, level, internalFormat, width, height, 0, pixelFormat(internalFormat), GL_UNSIGNED_BYTE, nullptr);
+                }
+                width = width > 1 ? width / 2 : 1;
+                height = height > 1 ? height / 2 : 1;
+            }
+        }
+        glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    // the number of levels in a full mip chain, down to 1x1
+    static GLsizei mipLevels(GLsizei width, GLsizei height) {
+        GLsizei levels = 1;
+        GLsizei size = width > height ? width : height;
+        while (size > 1) {
+            size /= 2;
+            levels++;
+        }
+        return levels;
+    }
+
+private:
+
+    GLenum target;
+
+    // glTexImage2D rejects integer textures unless told the pixels are integers too
+    static GLenum pixelFormat(GLenum internalFormat) {
+        switch (internalFormat) {
+        case GL_RGBA8UI:
+        case GL_RGBA16UI:
+        case GL_RGBA32UI:
+            return GL_RGBA_INTEGER;
+        default:
+            return GL_RGBA;
+        }
+    }
+};
+
+class Shader : public Object<ShaderTraits> {
+
+public:
+
+    // compiles length characters of source into a shader of the given type
+    static Shader create(GLenum type, const GLchar* source, GLint length) {
+        Shader shader;
+        shader.id = glCreateShader(type);
+        glShaderSource(shader.id, 1, &source, &length);
+        glCompileShader(shader.id);
+        checkShaderCompileStatus(shader.id);
+        return shader;
+    }
+};
+
+class Program : public Object<ProgramTraits> {
+
+public:
+
+    // creates an empty program; attach the shaders and bind the attributes
+    // before linking it
+    static Program create() {
+        Program program;
+        program.id = glCreateProgram();
+        return program;
+    }
+
+    void attach(const Shader& shader) {
+        glAttachShader(id, shader.getId());
+    }
+
+    void bindAttribLocation(GLuint index, const GLchar* name) {
+        glBindAttribLocation(id, index, name);
+    }
+
+    // links the program, then detaches the shaders: the program no longer needs
+    // them, and an attached shader is not deleted until its program is
+    bool link() {
+        glLinkProgram(id);
+        GLuint shaders[8];
+        GLsizei count;
+        glGetAttachedShaders(id, 8, &count, shaders);
+        for (GLsizei i = 0; i < count; i++) {
+            glDetachShader(id, shaders[i]);
+        }
+        return checkProgramLinkStatus(id);
+    }
+
+    void use() const { glUseProgram(id); }
+};
+
+class VertexArray : public Object<VertexArrayTraits> {
+
+public:
+
+    // creates a vertex array and leaves it bound
+    static VertexArray create() {
+        VertexArray vertexArray;
+        glGenVertexArrays(1, &vertexArray.id);
+        glBindVertexArray(vertexArray.id);
+        return vertexArray;
+    }
+
+    void bind() const { glBindVertexArray(id); }
+};
+
+class Query : public Object<QueryTraits> {
+
+public:
+
+    // creates a query object, which gets its type from its first use
+    static Query create() {
+        Query query;
+        glGenQueries(1, &query.id);
+        return query;
+    }
+};
+
+}
+
+#endif
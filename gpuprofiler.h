@@ -0,0 +1,311 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "globjects.h"
+
+/*
+ * GPU time of the passes of a frame, from timer queries:
+ *
+ *     CGLCORE_GPU_PROFILE=1 ./tutorial09            // logs every second
+ *     CGLCORE_GPU_PROFILE=gpu.json ./tutorial09     // and dumps at exit
+ *
+ * A scope writes a GL_TIMESTAMP query where it begins and one where it ends,
+ * so scopes may nest, unlike GL_TIME_ELAPSED queries. The queries of a frame
+ * come from one slot of a ring and are read back when the ring comes around
+ * to it, a few frames later, so that nothing waits for the GPU; a frame
+ * whose queries are still pending by then is counted as late and skipped.
+ *
+ * The log and the dump give the average time per frame of each scope, a
+ * scope entered several times in a frame adding up. Software rasterizers
+ * such as Mesa's llvmpipe only draw when the commands are flushed, and
+ * without a flush at each timestamp would charge all of a frame to the
+ * swap; the profiler flushes there when it finds one.
+ */
+
+class GpuProfiler {
+
+public:
+
+    // the results of a frame are read latency frames after it
+    explicit GpuProfiler(int latency = 4) : frames(latency), current(0), enabled(false), flushScopes(false),
+        framesRead(0), framesLate(0), windowFrames(0) {}
+
+    // enables the scopes if the driver has timer queries; a non empty
+    // dumpPath is written by finish(). The context must be current
+    bool start(const std::string& dumpPath = "") {
+        if (!GLEW_VERSION_3_3 && !GLEW_ARB_timer_query) {
+            printf("GPU profiling needs OpenGL 3.3 or GL_ARB_timer_query\n");
+            return false;
+        }
+        flushScopes = rasterizesOnFlush();
+        this->dumpPath = dumpPath;
+        lastLog = std::chrono::steady_clock::now();
+        enabled = true;
+        return true;
+    }
+
+    // CGLCORE_GPU_PROFILE=1 only logs, any other value is the dump path
+    bool startFromEnvironment() {
+        const char* value = getenv("CGLCORE_GPU_PROFILE");
+        if (value == nullptr || *value == 0) {
+            return false;
+        }
+        return start(strcmp(value, "1") == 0 ? "" : value);
+    }
+
+    bool profiling() const {
+        return enabled;
+    }
+
+    // whether the current context is a software rasterizer that draws when
+    // the commands are flushed, and only stamps queries then
+    static bool rasterizesOnFlush() {
+        const char* renderer = (const char*) glGetString(GL_RENDERER);
+        return renderer != nullptr && (strstr(renderer, "llvmpipe") != nullptr ||
+            strstr(renderer, "softpipe") != nullptr || strstr(renderer, "swrast") != nullptr);
+    }
+
+    // call it first in a frame: it reads back the frame that used the slot
+    // before, and logs once a second
+    void beginFrame() {
+        if (!enabled) {
+            return;
+        }
+        current = (current + 1) % frames.size();
+        Frame& frame = frames[current];
+        if (!frame.records.empty()) {
+            collect(frame);
+        }
+        frame.records.clear();
+        frame.queriesUsed = 0;
+        open.clear();
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastLog >= std::chrono::seconds(1)) {
+            log();
+            lastLog = now;
+        }
+    }
+
+    // name must outlive the profiler, a string literal typically
+    void begin(const char* name) {
+        if (!enabled) {
+            return;
+        }
+        Frame& frame = frames[current];
+        Record record;
+        record.scope = scopeIndex(name);
+        record.start = timestamp(frame);
+        record.end = -1;
+        open.push_back(frame.records.size());
+        frame.records.push_back(record);
+    }
+
+    void end() {
+        if (!enabled || open.empty()) {
+            return;
+        }
+        Frame& frame = frames[current];
+        frame.records[open.back()].end = timestamp(frame);
+        open.pop_back();
+    }
+
+    // times the GL commands issued during its lifetime
+    class Scope {
+
+    public:
+
+        Scope(GpuProfiler& profiler, const char* name) : profiler(profiler) {
+            profiler.begin(name);
+        }
+
+        ~Scope() {
+            profiler.end();
+        }
+
+    private:
+
+        GpuProfiler& profiler;
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // the average ms per frame of the scope since start, 0 if unknown
+    double getMillisPerFrame(const char* name) const {
+        for (size_t i = 0; i < scopes.size(); i++) {
+            if (scopes[i].name == name && framesRead > 0) {
+                return scopes[i].total / framesRead;
+            }
+        }
+        return 0.0;
+    }
+
+    long getFramesRead() const { return framesRead; }
+    long getFramesLate() const { return framesLate; }
+
+    // prints the averages per frame since the previous log
+    void log() {
+        if (windowFrames == 0) {
+            return;
+        }
+        std::string line;
+        char text[128];
+        for (size_t i = 0; i < scopes.size(); i++) {
+            snprintf(text, sizeof(text), ", %s %.3f", scopes[i].name.c_str(), scopes[i].windowTotal / windowFrames);
+            line += text;
+            scopes[i].windowTotal = 0.0;
+        }
+        printf("GPU ms per frame over %ld frames%s\n", windowFrames, line.c_str());
+        windowFrames = 0;
+    }
+
+    // writes the averages since start as JSON
+    bool dump(const std::string& path) const {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            printf("Cannot write %s\n", path.c_str());
+            return false;
+        }
+        fprintf(file, "{\n  \"framesRead\": %ld,\n  \"framesLate\": %ld,\n  \"flushedScopes\": %s,\n  \"scopes\": [",
+            framesRead, framesLate, flushScopes ? "true" : "false");
+        for (size_t i = 0; i < scopes.size(); i++) {
+            const Stats& stats = scopes[i];
+            fprintf(file, "%s\n    { \"name\": \"%s\", \"calls\": %ld, \"frames\": %ld, \"msPerFrame\": %.4f, "
+                "\"msPerCall\": %.4f, \"minMs\": %.4f, \"maxMs\": %.4f }", i == 0 ? "" : ",", stats.name.c_str(),
+                stats.calls, stats.frames, framesRead > 0 ? stats.total / framesRead : 0.0,
+                stats.calls > 0 ? stats.total / stats.calls : 0.0, stats.frames > 0 ? stats.min : 0.0, stats.max);
+        }
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+        return true;
+    }
+
+    // writes the dump if one was asked for, and deletes the queries; the
+    // context must still be current
+    void finish() {
+        if (!enabled) {
+            return;
+        }
+        if (!dumpPath.empty() && dump(dumpPath)) {
+            printf("GPU profile of %ld frames written to %s\n", framesRead, dumpPath.c_str());
+        }
+        for (size_t i = 0; i < frames.size(); i++) {
+            frames[i] = Frame();
+        }
+        open.clear();
+        enabled = false;
+    }
+
+private:
+
+    // a scope entered in a frame, as the indices of its queries in the slot
+    struct Record {
+        int scope;
+        int start;
+        int end;
+    };
+
+    struct Frame {
+        Frame() : queriesUsed(0) {}
+        std::vector<gl::Query> queries;
+        int queriesUsed;
+        std::vector<Record> records;
+    };
+
+    struct Stats {
+        std::string name;
+        double total;
+        double windowTotal;
+        double min;
+        double max;
+        long calls;
+        long frames;
+    };
+
+    std::vector<Frame> frames;
+    size_t current;
+    std::vector<size_t> open;
+    std::vector<Stats> scopes;
+    std::string dumpPath;
+    bool enabled;
+    bool flushScopes;
+    long framesRead;
+    long framesLate;
+    long windowFrames;
+    std::chrono::steady_clock::time_point lastLog;
+
+    int scopeIndex(const char* name) {
+        for (size_t i = 0; i < scopes.size(); i++) {
+            if (scopes[i].name == name) {
+                return i;
+            }
+        }
+        Stats stats = { name, 0.0, 0.0, 0.0, 0.0, 0, 0 };
+        scopes.push_back(stats);
+        return scopes.size() - 1;
+    }
+
+    // records the time the GPU gets to this point, returns the query index
+    int timestamp(Frame& frame) {
+        if (flushScopes) {
+            glFlush();
+        }
+        if (frame.queriesUsed == (int) frame.queries.size()) {
+            frame.queries.push_back(gl::Query::create());
+        }
+        glQueryCounter(frame.queries[frame.queriesUsed].getId(), GL_TIMESTAMP);
+        if (flushScopes) {
+            // llvmpipe stamps the query when it rasterizes the batch holding
+            // it, which must not be the batch of the commands that follow
+            glFlush();
+        }
+        return frame.queriesUsed++;
+    }
+
+    void collect(const Frame& frame) {
+        // the queries complete in order, the last one tells for all
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.queriesUsed - 1].getId(), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            framesLate++;
+            return;
+        }
+        std::vector<GLuint64> times(frame.queriesUsed);
+        for (int i = 0; i < frame.queriesUsed; i++) {
+            glGetQueryObjectui64v(frame.queries[i].getId(), GL_QUERY_RESULT, &times[i]);
+        }
+        std::vector<double> sums(scopes.size(), -1.0);
+        for (size_t i = 0; i < frame.records.size(); i++) {
+            const Record& record = frame.records[i];
+            if (record.end < 0) {
+                // never ended
+                continue;
+            }
+            double millis = (times[record.end] - times[record.start]) / 1e6;
+            sums[record.scope] = std::max(sums[record.scope], 0.0) + millis;
+            scopes[record.scope].calls++;
+        }
+        for (size_t i = 0; i < scopes.size(); i++) {
+            if (sums[i] < 0.0) {
+                continue;
+            }
+            Stats& stats = scopes[i];
+            stats.min = stats.frames == 0 ? sums[i] : std::min(stats.min, sums[i]);
+            stats.max = std::max(stats.max, sums[i]);
+            stats.total += sums[i];
+            stats.windowTotal += sums[i];
+            stats.frames++;
+        }
+        framesRead++;
+        windowFrames++;
+    }
+};
+
+#endif
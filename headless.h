@@ -0,0 +1,463 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "globjects.h"
+#include "gpuprofiler.h"
+
+/*
+ * Rendering without a display server, for the machines that have neither a
+ * screen nor a GPU:
+ *
+ *     ./tutorial09 -headless 300 1920x1080
+ *
+ * renders 300 frames of the scene at 1920 x 1080 and prints the time they
+ * took; both numbers are optional. CGLCORE_CAPTURE and CGLCORE_GPU_PROFILE
+ * work as they do with a window. For benchmarks,
+ *
+ *     ./tutorial09 -headless 300 1920x1080 -warmup 30 -report run.json
+ *
+ * first renders 30 frames that are not measured, then writes the
+ * distributions of the CPU time to submit each frame (from the start of
+ * render() to the swap), of the GPU time of each frame (from timestamp
+ * queries read once all frames are done) and of the wall time of each frame
+ * as one line of JSON. -timings path writes the times of each measured
+ * frame, one line per frame, for two runs that render the same frames (see
+ * replay.h) to be compared frame by frame. To see that a scene frees what it
+ * creates,
+ *
+ *     ./tutorial09 -headless 60 -cycles 20
+ *
+ * builds the scene, renders 60 frames of it and releases it, 20 times over,
+ * then prints the peak resident memory of the process, the memory left
+ * resident after the first and the last release and, with
+ * GL_NVX_gpu_memory_info, the video memory left free after them. The first
+ * cycles warm up the allocator and the driver; after them, a scene that
+ * leaks is one whose memory after the last release grows with the cycles.
+ *
+ * The context comes from EGL: on Mesa's surfaceless platform when there is
+ * one (llvmpipe when there is no GPU), else on the first device of
+ * EGL_EXT_platform_device (the NVIDIA driver), else on the default display.
+ * It has no surface and so no default framebuffer: the frames are rendered
+ * into a framebuffer object, with a color and a depth renderbuffer, that
+ * stays bound. Code that redirects rendering elsewhere must hence restore
+ * the framebuffer it found bound rather than bind 0.
+ */
+
+class Headless {
+
+public:
+
+    Headless() : enabled(false), frameCount(60), warmupFrames(0), cycleCount(0), width(1280), height(720), display(EGL_NO_DISPLAY),
+        context(EGL_NO_CONTEXT), framebuffer(0) {
+        renderbuffers[0] = renderbuffers[1] = 0;
+    }
+
+    // takes "-headless [frames] [width x height]", "-warmup frames",
+    // "-report path", "-timings path" and "-cycles count" out of the
+    // arguments, call it before the tutorial reads its own
+    bool parseArguments(int& argc, char** argv) {
+        const char* name = strrchr(argv[0], '/');
+        program = name != nullptr ? name + 1 : argv[0];
+        int kept = 1;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) {
+                warmupFrames = std::max(0, atoi(argv[++i]));
+                continue;
+            }
+            if (strcmp(argv[i], "-report") == 0 && i + 1 < argc) {
+                reportPath = argv[++i];
+                continue;
+            }
+            if (strcmp(argv[i], "-timings") == 0 && i + 1 < argc) {
+                timingsPath = argv[++i];
+                continue;
+            }
+            if (strcmp(argv[i], "-cycles") == 0 && i + 1 < argc) {
+                cycleCount = std::max(0, atoi(argv[++i]));
+                continue;
+            }
+            if (strcmp(argv[i], "-headless") != 0) {
+                program += " ";
+                program += argv[i];
+                argv[kept++] = argv[i];
+                continue;
+            }
+            enabled = true;
+            bool framesRead = false;
+            bool sizeRead = false;
+            while (i + 1 < argc) {
+                int w, h;
+                char rest;
+                if (!sizeRead && sscanf(argv[i + 1], "%dx%d%c", &w, &h, &rest) == 2 && w > 0 && h > 0) {
+                    width = w;
+                    height = h;
+                    sizeRead = true;
+                } else if (!framesRead && isdigit(argv[i + 1][0]) && strspn(argv[i + 1], "0123456789") == strlen(argv[i + 1])) {
+                    frameCount = atoi(argv[i + 1]);
+                    framesRead = true;
+                } else {
+                    break;
+                }
+                i++;
+            }
+        }
+        argc = kept;
+        argv[argc] = nullptr;
+        return enabled;
+    }
+
+    bool active() const {
+        return enabled;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    // creates the context and the framebuffer, leaves them current and
+    // initializes GLEW
+    bool create() {
+        display = openDisplay();
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+            printf("No EGL display to render without a window\n");
+            return false;
+        }
+        const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (extensions == nullptr || strstr(extensions, "EGL_KHR_surfaceless_context") == nullptr) {
+            printf("EGL %d.%d cannot make a context current without a surface\n", major, minor);
+            return false;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+        // any surface type, the default only matches the configs of windows
+        EGLint configAttributes[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+            printf("No EGL config for desktop OpenGL\n");
+            return false;
+        }
+        // the compatibility profile, as the windows get, else the core one
+        EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT, EGL_NONE };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT) {
+            contextAttributes[5] = EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT;
+            context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        }
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            printf("Could not create an OpenGL 3.3 context with EGL\n");
+            return false;
+        }
+
+        // a GLEW built for GLX reports that there is no GLX display, after
+        // loading the GL functions
+        glewExperimental = GL_TRUE;
+        glewInit();
+
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(2, renderbuffers);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            printf("Incomplete %d x %d framebuffer\n", width, height);
+            return false;
+        }
+        glViewport(0, 0, width, height);
+        printf("Rendering without a window on %s\n", (const char*) glGetString(GL_RENDERER));
+        return true;
+    }
+
+    // reallocates the framebuffer, for the resizes of a replayed session
+    void resize(int width, int height) {
+        if (framebuffer == 0 || width <= 0 || height <= 0 || (width == this->width && height == this->height)) {
+            return;
+        }
+        this->width = width;
+        this->height = height;
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glViewport(0, 0, width, height);
+    }
+
+    // what swapping the buffers is to a window: the frame is submitted
+    void swap() {
+        swapStart = std::chrono::steady_clock::now();
+        glFlush();
+    }
+
+    // renders the warm-up frames and the measured ones with render, which
+    // must swap, and prints the time until the last one is done; with
+    // -cycles, builds and releases the scene instead, see cycle()
+    void run(void (*render)(), void (*releaseScene)() = nullptr) {
+        if (cycleCount > 0 && releaseScene != nullptr) {
+            cycle(render, releaseScene);
+            return;
+        }
+        for (int i = 0; i < warmupFrames; i++) {
+            render();
+        }
+        glFinish();
+
+        bool timed = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        bool flushes = GpuProfiler::rasterizesOnFlush();
+        std::vector<gl::Query> queries;
+        for (int i = 0; timed && i < 2 * frameCount; i++) {
+            queries.push_back(gl::Query::create());
+        }
+        std::vector<double> submitMillis;
+        std::vector<double> frameMillis;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frameCount; i++) {
+            std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+            swapStart = frameStart;
+            if (timed) {
+                timestamp(queries[2 * i], flushes);
+            }
+            render();
+            if (timed) {
+                timestamp(queries[2 * i + 1], flushes);
+            }
+            std::chrono::steady_clock::time_point frameEnd = std::chrono::steady_clock::now();
+            submitMillis.push_back(std::chrono::duration<double, std::milli>(swapStart - frameStart).count());
+            frameMillis.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+        }
+        glFinish();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Rendered %d frames at %d x %d in %.2f s, %.2f ms per frame\n", frameCount, width, height, seconds,
+            frameCount > 0 ? seconds * 1000.0 / frameCount : 0.0);
+
+        // all done, reading the queries waits for nothing
+        std::vector<double> gpuMillis;
+        for (size_t i = 0; i + 1 < queries.size(); i += 2) {
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(queries[i].getId(), GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[i + 1].getId(), GL_QUERY_RESULT, &end);
+            gpuMillis.push_back((end - begin) / 1e6);
+        }
+        if (!reportPath.empty()) {
+            writeReport(seconds, submitMillis, gpuMillis, frameMillis);
+        }
+        if (!timingsPath.empty()) {
+            writeTimings(submitMillis, gpuMillis, frameMillis);
+        }
+    }
+
+    // renders the frames, render building the scene on the first one, then
+    // releases it with releaseScene, as many times as -cycles asks for, and
+    // prints the memory the process kept; the session the scene runs in, its
+    // capture, profiling, recording and trace, goes on across the cycles
+    void cycle(void (*render)(), void (*releaseScene)()) {
+        long firstResident = 0;
+        long lastResident = 0;
+        GLint firstFree = 0;
+        GLint lastFree = 0;
+        bool gpuMemory = GLEW_NVX_gpu_memory_info;
+        for (int i = 0; i < cycleCount; i++) {
+            for (int j = 0; j < frameCount; j++) {
+                render();
+            }
+            releaseScene();
+            glFinish();
+            lastResident = memoryKilobytes("VmRSS:");
+            if (gpuMemory) {
+                glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &lastFree);
+            }
+            if (i == 0) {
+                firstResident = lastResident;
+                firstFree = lastFree;
+            }
+        }
+        printf("Built, rendered %d frames of and released the scene %d times: %.1f MB resident at the peak, "
+            "%.1f MB after the first release and %.1f MB after the last\n", frameCount, cycleCount,
+            memoryKilobytes("VmHWM:") / 1024.0, firstResident / 1024.0, lastResident / 1024.0);
+        if (gpuMemory) {
+            printf("Video memory free after the first release: %.1f MB, after the last: %.1f MB\n",
+                firstFree / 1024.0, lastFree / 1024.0);
+        }
+    }
+
+    // after the scene has released its objects
+    void destroy() {
+        if (framebuffer != 0) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(2, renderbuffers);
+            framebuffer = 0;
+        }
+        if (display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT) {
+                eglDestroyContext(display, context);
+                context = EGL_NO_CONTEXT;
+            }
+            eglTerminate(display);
+            display = EGL_NO_DISPLAY;
+        }
+    }
+
+private:
+
+    bool enabled;
+    int frameCount;
+    int warmupFrames;
+    int cycleCount;
+    std::string program;
+    std::string reportPath;
+    std::string timingsPath;
+    std::chrono::steady_clock::time_point swapStart;
+    int width;
+    int height;
+    EGLDisplay display;
+    EGLContext context;
+    GLuint framebuffer;
+    GLuint renderbuffers[2];
+
+    // a line of /proc/self/status in kB, such as VmRSS, 0 when there is none
+    static long memoryKilobytes(const char* name) {
+        FILE* file = fopen("/proc/self/status", "r");
+        if (file == nullptr) {
+            return 0;
+        }
+        char line[256];
+        long kilobytes = 0;
+        size_t length = strlen(name);
+        while (fgets(line, sizeof(line), file) != nullptr) {
+            if (strncmp(line, name, length) == 0) {
+                kilobytes = atol(line + length);
+                break;
+            }
+        }
+        fclose(file);
+        return kilobytes;
+    }
+
+    // see GpuProfiler for the flushes
+    static void timestamp(const gl::Query& query, bool flushes) {
+        if (flushes) {
+            glFlush();
+        }
+        glQueryCounter(query.getId(), GL_TIMESTAMP);
+        if (flushes) {
+            glFlush();
+        }
+    }
+
+    // a JSON string: the arguments and the renderer may hold quotes,
+    // backslashes or control characters
+    static void writeString(FILE* file, const char* s) {
+        fputc('"', file);
+        for (; s != nullptr && *s != '\0'; s++) {
+            if (*s == '"' || *s == '\\') {
+                fputc('\\', file);
+                fputc(*s, file);
+            } else if ((unsigned char) *s < 0x20) {
+                fprintf(file, "\\u%04x", (unsigned char) *s);
+            } else {
+                fputc(*s, file);
+            }
+        }
+        fputc('"', file);
+    }
+
+    static void writeDistribution(FILE* file, const char* name, std::vector<double> values) {
+        if (values.empty()) {
+            fprintf(file, ", \"%s\": null", name);
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        double total = 0.0;
+        for (size_t i = 0; i < values.size(); i++) {
+            total += values[i];
+        }
+        const double ranks[] = { 50, 90, 99 };
+        fprintf(file, ", \"%s\": { \"mean\": %.4f, \"min\": %.4f", name, total / values.size(), values.front());
+        for (int i = 0; i < 3; i++) {
+            size_t rank = std::min((size_t) (ranks[i] / 100.0 * values.size()), values.size() - 1);
+            fprintf(file, ", \"p%.0f\": %.4f", ranks[i], values[rank]);
+        }
+        fprintf(file, ", \"max\": %.4f }", values.back());
+    }
+
+    // one line, so that the reports of two builds compare with diff
+    void writeReport(double seconds, const std::vector<double>& submitMillis, const std::vector<double>& gpuMillis,
+        const std::vector<double>& frameMillis) {
+        FILE* file = fopen(reportPath.c_str(), "w");
+        if (file == nullptr) {
+            printf("Cannot write %s\n", reportPath.c_str());
+            return;
+        }
+        fprintf(file, "{ \"program\": ");
+        writeString(file, program.c_str());
+        fprintf(file, ", \"renderer\": ");
+        writeString(file, (const char*) glGetString(GL_RENDERER));
+        fprintf(file, ", \"width\": %d, \"height\": %d, \"warmupFrames\": %d, \"frames\": %d, \"seconds\": %.4f",
+            width, height, warmupFrames, frameCount, seconds);
+        writeDistribution(file, "submitMs", submitMillis);
+        writeDistribution(file, "gpuMs", gpuMillis);
+        writeDistribution(file, "frameMs", frameMillis);
+        fprintf(file, " }\n");
+        fclose(file);
+    }
+
+    // the frame number first, and -1 when the GPU was not timed
+    void writeTimings(const std::vector<double>& submitMillis, const std::vector<double>& gpuMillis,
+        const std::vector<double>& frameMillis) {
+        FILE* file = fopen(timingsPath.c_str(), "w");
+        if (file == nullptr) {
+            printf("Cannot write %s\n", timingsPath.c_str());
+            return;
+        }
+        fprintf(file, "# frame submitMs gpuMs frameMs\n");
+        for (size_t i = 0; i < frameMillis.size(); i++) {
+            fprintf(file, "%d %.4f %.4f %.4f\n", warmupFrames + (int) i, submitMillis[i],
+                i < gpuMillis.size() ? gpuMillis[i] : -1.0, frameMillis[i]);
+        }
+        fclose(file);
+    }
+
+    static EGLDisplay openDisplay() {
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (clientExtensions != nullptr && getPlatformDisplay != nullptr) {
+            if (strstr(clientExtensions, "EGL_MESA_platform_surfaceless") != nullptr) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+                if (display != EGL_NO_DISPLAY) {
+                    return display;
+                }
+            }
+            PFNEGLQUERYDEVICESEXTPROC queryDevices = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+            EGLDeviceEXT device;
+            EGLint deviceCount = 0;
+            if (strstr(clientExtensions, "EGL_EXT_platform_device") != nullptr && queryDevices != nullptr &&
+                queryDevices(1, &device, &deviceCount) && deviceCount > 0) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+                if (display != EGL_NO_DISPLAY) {
+                    return display;
+                }
+            }
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+};
+
+#endif
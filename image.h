@@ -0,0 +1,364 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <vector>
+#include <algorithm>
+#include <jpeglib.h>
+#include <png.h>
+#include "pixels.h"
+#include "tracer.h"
+
+/*
+ * Decoding of JPEG (libjpeg-turbo) and PNG (libpng) images held in memory,
+ * straight into a buffer provided by the caller: plain memory, or a mapped
+ * pixel buffer object so that the pixels go from the decoder to the driver
+ * without any intermediate copy. The decoders convert to RGB or RGBA on the
+ * fly, and the rows can be written bottom to top, which is the order GL
+ * expects them in, at no cost.
+ *
+ *     ImageDecoder decoder;
+ *     decoder.open(data, size);
+ *     pixels = allocate(decoder.getWidth() * decoder.getHeight() * 4);
+ *     decoder.decode(pixels, 4, true);
+ *
+ * Large images can also be decoded a band of rows at a time, with
+ * startRows(), readRows() and finishRows(), so that only one band has to be
+ * held in memory while the previous one is handed to GL.
+ *
+ * setPremultiplyAlpha() has the color channels multiplied by alpha, as
+ * needed for blending with GL_ONE, GL_ONE_MINUS_SRC_ALPHA; this is done a
+ * few rows at a time right after they are decoded, in the same pass.
+ */
+
+enum ImageType {
+    IMAGE_UNKNOWN,
+    IMAGE_JPEG,
+    IMAGE_PNG
+};
+
+class ImageDecoder {
+
+public:
+
+    ImageDecoder() : type(IMAGE_UNKNOWN), data(nullptr), next(nullptr), end(nullptr), png(nullptr), pngInfo(nullptr),
+        width(0), height(0), channels(0), interlaced(false), outChannels(0), rowsRead(0), premultiply(false) {}
+
+    ~ImageDecoder() {
+        close();
+    }
+
+    // reads the header of the image held in the size bytes at data
+    bool open(const unsigned char* data, size_t size) {
+        close();
+        this->data = data;
+        end = data + size;
+        if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff) {
+            type = IMAGE_JPEG;
+            return openJpeg(size);
+        }
+        if (size >= 8 && png_sig_cmp((png_const_bytep) data, 0, 8) == 0) {
+            type = IMAGE_PNG;
+            return openPng();
+        }
+        printf("Unknown image format\n");
+        return false;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    ImageType getType() const { return type; }
+
+    // the channels of the image itself: 4 if it has transparency, 3 otherwise
+    int getChannels() const { return channels; }
+
+    // multiplies the colors by alpha in the RGBA pixels decoded from now on;
+    // opaque images are left as they are
+    void setPremultiplyAlpha(bool premultiply) {
+        this->premultiply = premultiply;
+    }
+
+    // true when the rows can be read in bands with readRows(); interlaced
+    // PNG files only have their final rows once the whole image is decoded
+    bool canStream() const {
+        return type == IMAGE_JPEG || (type == IMAGE_PNG && !interlaced);
+    }
+
+    // decodes the whole image into pixels, which must hold width * height *
+    // outChannels bytes; outChannels is 3 for RGB or 4 for RGBA, opaque
+    // images get an alpha of 255. flip stores the last row first
+    bool decode(unsigned char* pixels, int outChannels, bool flip) {
+        Tracer::Scope trace("decode image");
+        if (canStream()) {
+            bool decoded = startRows(outChannels) && readRows(pixels, height, flip);
+            return finishRows() && decoded;
+        }
+        std::vector<unsigned char*> rows(height);
+        size_t stride = (size_t) width * outChannels;
+        for (int y = 0; y < height; y++) {
+            rows[y] = pixels + (flip ? height - 1 - y : y) * stride;
+        }
+        bool decoded = startRows(outChannels) && readInterlacedPng(rows.data());
+        close();
+        if (decoded && premultiplying()) {
+            parallelRows(height, stride, [=](int first, int last) {
+                premultiplyAlpha(pixels + first * stride, pixels + first * stride, (size_t) (last - first) * width);
+            });
+        }
+        return decoded;
+    }
+
+    // starts decoding the image a band of rows at a time, with outChannels
+    // per pixel; the memory needed is then that of a band, not of the image
+    bool startRows(int outChannels) {
+        this->outChannels = outChannels;
+        rowsRead = 0;
+        if (type == IMAGE_JPEG) {
+            return startJpeg();
+        } else if (type == IMAGE_PNG) {
+            return startPng();
+        }
+        return false;
+    }
+
+    // decodes the next count rows, from the top of the image, into pixels
+    // which holds count * width * outChannels bytes; flip stores them in
+    // reverse order, the band then goes right below the previous one in GL
+    bool readRows(unsigned char* pixels, int count, bool flip) {
+        count = std::min(count, height - rowsRead);
+        std::vector<unsigned char*> rows(count);
+        size_t stride = (size_t) width * outChannels;
+        for (int y = 0; y < count; y++) {
+            rows[y] = pixels + (flip ? count - 1 - y : y) * stride;
+        }
+        // a few rows at a time, converted while they are still in the cache
+        bool decoded = true;
+        for (int first = 0; decoded && first < count; first += CONVERT_ROWS) {
+            int chunk = std::min((int) CONVERT_ROWS, count - first);
+            if (type == IMAGE_JPEG) {
+                decoded = readJpegRows(rows.data() + first, chunk);
+            } else if (type == IMAGE_PNG) {
+                decoded = readPngRows(rows.data() + first, chunk);
+            } else {
+                decoded = false;
+            }
+            for (int y = first; decoded && premultiplying() && y < first + chunk; y++) {
+                premultiplyAlpha(rows[y], rows[y], width);
+            }
+        }
+        rowsRead += count;
+        return decoded;
+    }
+
+    // the number of rows readRows() has delivered so far
+    int getRowsRead() const { return rowsRead; }
+
+    // completes the decoding and releases the decoder
+    bool finishRows() {
+        bool finished = false;
+        if (type == IMAGE_JPEG) {
+            finished = finishJpeg();
+        } else if (type == IMAGE_PNG) {
+            finished = finishPng();
+        }
+        close();
+        return finished;
+    }
+
+private:
+
+    // libjpeg calls exit() on errors unless error_exit jumps back to us
+    struct JpegError {
+        jpeg_error_mgr manager;
+        jmp_buf jump;
+    };
+
+    // the rows decoded between two conversion passes
+    static const int CONVERT_ROWS = 16;
+
+    ImageType type;
+    const unsigned char* data;
+    const unsigned char* next;
+    // past the last byte of the image, which a truncated PNG must not read
+    const unsigned char* end;
+    jpeg_decompress_struct jpeg;
+    JpegError jpegError;
+    png_structp png;
+    png_infop pngInfo;
+    int width;
+    int height;
+    int channels;
+    bool interlaced;
+    int outChannels;
+    int rowsRead;
+    bool premultiply;
+    std::vector<unsigned char> rgbRow;
+
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    bool premultiplying() const {
+        return premultiply && outChannels == 4 && channels == 4;
+    }
+
+    static void jpegErrorExit(j_common_ptr cinfo) {
+        char message[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, message);
+        printf("JPEG decoding failed: %s\n", message);
+        longjmp(((JpegError*) cinfo->err)->jump, 1);
+    }
+
+    // feeds libpng with the bytes of the image held in memory
+    static void readPngData(png_structp png, png_bytep out, png_size_t length) {
+        ImageDecoder* decoder = (ImageDecoder*) png_get_io_ptr(png);
+        if (length > (size_t) (decoder->end - decoder->next)) {
+            png_error(png, "truncated image");
+        }
+        memcpy(out, decoder->next, length);
+        decoder->next += length;
+    }
+
+    bool openJpeg(size_t size) {
+        jpeg.err = jpeg_std_error(&jpegError.manager);
+        jpegError.manager.error_exit = jpegErrorExit;
+        jpeg_create_decompress(&jpeg);
+        if (setjmp(jpegError.jump)) {
+            close();
+            return false;
+        }
+        jpeg_mem_src(&jpeg, (unsigned char*) data, size);
+        jpeg_read_header(&jpeg, TRUE);
+        width = jpeg.image_width;
+        height = jpeg.image_height;
+        channels = 3;
+        return true;
+    }
+
+    bool startJpeg() {
+        if (setjmp(jpegError.jump)) {
+            return false;
+        }
+#ifdef JCS_EXTENSIONS
+        jpeg.out_color_space = outChannels == 4 ? JCS_EXT_RGBA : JCS_RGB;
+#else
+        jpeg.out_color_space = JCS_RGB;
+#endif
+        jpeg_start_decompress(&jpeg);
+        return true;
+    }
+
+    bool readJpegRows(unsigned char** rows, int count) {
+        if (setjmp(jpegError.jump)) {
+            return false;
+        }
+        int done = 0;
+        while (done < count) {
+            int read = jpeg_read_scanlines(&jpeg, rows + done, count - done);
+#ifndef JCS_EXTENSIONS
+            // plain libjpeg only knows RGB, widen the rows through a copy
+            for (int y = done; outChannels == 4 && y < done + read; y++) {
+                rgbRow.assign(rows[y], rows[y] + width * 3);
+                expandRGBToRGBA(rgbRow.data(), rows[y], width);
+            }
+#endif
+            done += read;
+        }
+        return true;
+    }
+
+    bool finishJpeg() {
+        if (setjmp(jpegError.jump)) {
+            return false;
+        }
+        // libjpeg refuses to finish before all the rows were read
+        if (jpeg.output_scanline < jpeg.output_height) {
+            jpeg_abort_decompress(&jpeg);
+            return false;
+        }
+        jpeg_finish_decompress(&jpeg);
+        return true;
+    }
+
+    bool openPng() {
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        pngInfo = png != nullptr ? png_create_info_struct(png) : nullptr;
+        if (png == nullptr || pngInfo == nullptr) {
+            printf("Cannot allocate a PNG decoder\n");
+            close();
+            return false;
+        }
+        if (setjmp(png_jmpbuf(png))) {
+            close();
+            return false;
+        }
+        next = data;
+        png_set_read_fn(png, this, readPngData);
+        png_read_info(png, pngInfo);
+        width = png_get_image_width(png, pngInfo);
+        height = png_get_image_height(png, pngInfo);
+        bool alpha = (png_get_color_type(png, pngInfo) & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, pngInfo, PNG_INFO_tRNS);
+        channels = alpha ? 4 : 3;
+        interlaced = png_get_interlace_type(png, pngInfo) != PNG_INTERLACE_NONE;
+        return true;
+    }
+
+    bool startPng() {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        // whatever the image holds (palette, gray, 16 bits) comes out as 8 bit RGB(A)
+        png_set_expand(png);
+        png_set_strip_16(png);
+        png_set_gray_to_rgb(png);
+        if (outChannels == 4) {
+            png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+        } else {
+            png_set_strip_alpha(png);
+        }
+        png_set_interlace_handling(png);
+        png_read_update_info(png, pngInfo);
+        return true;
+    }
+
+    bool readPngRows(unsigned char** rows, int count) {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        png_read_rows(png, rows, nullptr, count);
+        return true;
+    }
+
+    bool readInterlacedPng(unsigned char** rows) {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        png_read_image(png, rows);
+        png_read_end(png, nullptr);
+        return true;
+    }
+
+    bool finishPng() {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        if (rowsRead < height) {
+            return false;
+        }
+        png_read_end(png, nullptr);
+        return true;
+    }
+
+    void close() {
+        if (type == IMAGE_JPEG) {
+            jpeg_destroy_decompress(&jpeg);
+        } else if (type == IMAGE_PNG) {
+            png_destroy_read_struct(&png, &pngInfo, nullptr);
+        }
+        type = IMAGE_UNKNOWN;
+    }
+};
+
+#endif
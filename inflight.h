@@ -0,0 +1,152 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <GL/glew.h>
+#include "tracer.h"
+
+/*
+ * A bound on the frames the CPU runs ahead of the GPU. Without vsync, and
+ * with nothing else to throttle it, the driver queues frame after frame
+ * behind the one the GPU draws, and the input read for a frame shows up on
+ * the screen only once all the frames ahead of it are drawn:
+ *
+ *     ./tutorial09 -inflight 1       // the CPU waits for each frame
+ *     ./tutorial09 -inflight 0       // no bound, only measures
+ *
+ * Right after each swap, throttle() puts a fence behind the frame and
+ * retires the fences the GPU has passed; the frames whose fence is still
+ * pending are those in flight. When there are more of them than the limit,
+ * 2 by default, it waits in glClientWaitSync() for the oldest ones. The
+ * fences are retired in order, as the GPU completes the frames in order.
+ *
+ * finish() prints how many frames were found in flight at the swaps, and
+ * how long the CPU waited for them. The waits also show in traces, see
+ * tracer.h.
+ */
+
+class FramesInFlight {
+
+public:
+
+    explicit FramesInFlight(int limit = 2) : limit(limit), checked(false), supported(false), frameCount(0),
+        framesWaited(0), depthTotal(0), depthMax(0), waitMillis(0.0), waitMillisMax(0.0) {}
+
+    // takes "-inflight frames" out of the arguments, 0 for no bound
+    void parseArguments(int& argc, char** argv) {
+        int kept = 1;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-inflight") == 0 && i + 1 < argc) {
+                limit = std::max(0, atoi(argv[++i]));
+            } else {
+                argv[kept++] = argv[i];
+            }
+        }
+        argc = kept;
+        argv[argc] = nullptr;
+    }
+
+    int getLimit() const {
+        return limit;
+    }
+
+    // right after the swap, with the context current
+    void throttle() {
+        if (!available()) {
+            return;
+        }
+        fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+        while (!fences.empty() && signaled(fences.front(), 0)) {
+            retire();
+        }
+        int depth = (int) fences.size();
+        frameCount++;
+        depthTotal += depth;
+        depthMax = std::max(depthMax, depth);
+        if (limit <= 0 || depth <= limit) {
+            return;
+        }
+        Tracer::Scope trace("wait for gpu");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while ((int) fences.size() > limit) {
+            // a second at most, a lost context must not hang the loop
+            signaled(fences.front(), 1000000000ull);
+            retire();
+        }
+        double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        framesWaited++;
+        waitMillis += millis;
+        waitMillisMax = std::max(waitMillisMax, millis);
+    }
+
+    // deletes the fences, with the context still current, and prints the
+    // queue depths and the waits
+    void finish() {
+        while (!fences.empty()) {
+            retire();
+        }
+        if (frameCount == 0) {
+            return;
+        }
+        char bound[32] = "unbounded";
+        if (limit > 0) {
+            snprintf(bound, sizeof(bound), "at most %d", limit);
+        }
+        printf("Frames in flight: %s, %.2f on average and %d at most at the swaps of %ld frames; "
+            "waited for the GPU in %ld of them, %.3f ms per frame, %.3f ms at most\n", bound,
+            1.0 * depthTotal / frameCount, depthMax, frameCount, framesWaited, waitMillis / frameCount, waitMillisMax);
+        frameCount = 0;
+        framesWaited = 0;
+        depthTotal = 0;
+        depthMax = 0;
+        waitMillis = 0.0;
+        waitMillisMax = 0.0;
+    }
+
+private:
+
+    int limit;
+    bool checked;
+    bool supported;
+    // the fences of the frames in flight, oldest first
+    std::deque<GLsync> fences;
+    long frameCount;
+    long framesWaited;
+    long depthTotal;
+    int depthMax;
+    double waitMillis;
+    double waitMillisMax;
+
+    FramesInFlight(const FramesInFlight&) = delete;
+    FramesInFlight& operator=(const FramesInFlight&) = delete;
+
+    // fences need OpenGL 3.2 or GL_ARB_sync, checked at the first frame
+    bool available() {
+        if (!checked) {
+            checked = true;
+            supported = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+            if (!supported) {
+                printf("Bounding the frames in flight needs OpenGL 3.2 or GL_ARB_sync\n");
+            }
+        }
+        return supported;
+    }
+
+    // flushes, so that a fence not yet sent to the GPU cannot wait forever
+    static bool signaled(GLsync fence, GLuint64 timeout) {
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+    }
+
+    void retire() {
+        glDeleteSync(fences.front());
+        fences.pop_front();
+    }
+};
+
+#endif
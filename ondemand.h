@@ -0,0 +1,95 @@
+#ifndef ONDEMAND_H
+#define ONDEMAND_H
+
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <atomic>
+
+/*
+ * Rendering on demand, for the scenes that only change when something tells
+ * them to: instead of drawing as fast as it can, the loop sleeps in poll() on
+ * the connection to the display until the server sends an event, and draws
+ * only once something invalidated the window:
+ *
+ *     while (!done) {
+ *         while (XPending(display) > 0) {
+ *             ...                              // Expose, ConfigureNotify:
+ *             redraw.invalidate();             // the window needs a frame
+ *         }
+ *         if (redraw.take()) {
+ *             render();
+ *             glXSwapBuffers(display, win);
+ *         } else {
+ *             redraw.wait(ConnectionNumber(display));
+ *         }
+ *     }
+ *
+ * XPending() flushes the requests and reads what the server sent, so once it
+ * returns 0 nothing is left in Xlib's queue that poll() could miss.
+ * invalidate() may be called from any thread, by animated content or a data
+ * feed, and wakes wait() through an eventfd; the invalidations made before a
+ * frame all come down to that frame.
+ */
+
+class RedrawSignal {
+
+public:
+
+    // the first frame is pending
+    RedrawSignal() : dirty(true) {
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~RedrawSignal() {
+        if (wakeFd >= 0) {
+            close(wakeFd);
+        }
+    }
+
+    // asks for a frame
+    void invalidate() {
+        dirty.store(true);
+        uint64_t one = 1;
+        if (wakeFd >= 0 && write(wakeFd, &one, sizeof(one)) < 0) {
+            // the counter is saturated, a wake up is pending anyway
+        }
+    }
+
+    // true when a frame was asked for since the previous call
+    bool take() {
+        return dirty.exchange(false);
+    }
+
+    // sleeps until fd has input or invalidate() is called, or timeoutMillis
+    // went by when not negative
+    void wait(int fd, int timeoutMillis = -1) {
+        pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = wakeFd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if (dirty.load()) {
+            return;
+        }
+        if (poll(fds, wakeFd >= 0 ? 2 : 1, timeoutMillis) > 0 && (fds[1].revents & POLLIN) != 0) {
+            uint64_t count;
+            if (read(wakeFd, &count, sizeof(count)) < 0) {
+                // another wait() drained it
+            }
+        }
+    }
+
+private:
+
+    std::atomic<bool> dirty;
+    int wakeFd;
+
+    RedrawSignal(const RedrawSignal&) = delete;
+    RedrawSignal& operator=(const RedrawSignal&) = delete;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <vector>
+#include "image.h"
+
+/*
+ * Build tool that packs two images into the channels of a single RGBA PNG file:
+ *
+ *     packer earth_day_night.png earth_day.jpg earth_night.jpg
+ *
+ * keeps the colors of the first image and stores the luminance of the second
+ * one in alpha, stretched to the size of the first one if needed, the way the
+ * shaders stretched it when it was a texture of its own. A shader then gets
+ * both layers from one texture fetch instead of two, and the texture takes 4
+ * bytes per texel instead of 8; it suits second layers whose color carries
+ * little information, like city lights or a cloud mask. The color image is
+ * streamed a row at a time, only the luminance of the other one is held in
+ * memory.
+ */
+
+// a source image mapped in memory, decoded a row at a time
+class SourceImage {
+
+public:
+
+    SourceImage() : mapping(MAP_FAILED), size(0) {}
+
+    ~SourceImage() {
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, size);
+        }
+    }
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            printf("Could not open %s\n", path);
+            return false;
+        }
+        size = st.st_size;
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED || !decoder.open((const unsigned char*) mapping, size)
+                || !decoder.canStream() || !decoder.startRows(3)) {
+            printf("Could not decode %s\n", path);
+            return false;
+        }
+        row.resize((size_t) decoder.getWidth() * 3);
+        return true;
+    }
+
+    int getWidth() const { return decoder.getWidth(); }
+    int getHeight() const { return decoder.getHeight(); }
+
+    // the next row, as RGB
+    const unsigned char* readRow() {
+        return decoder.readRows(row.data(), 1, false) ? row.data() : nullptr;
+    }
+
+    bool finish() {
+        return decoder.finishRows();
+    }
+
+    // decodes the remaining rows into a plane of Rec. 601 luma values
+    bool readLuminance(std::vector<unsigned char>& luminance) {
+        luminance.resize((size_t) getWidth() * getHeight());
+        for (int y = 0; y < getHeight(); y++) {
+            const unsigned char* rgb = readRow();
+            if (rgb == nullptr) {
+                return false;
+            }
+            unsigned char* out = &luminance[(size_t) y * getWidth()];
+            for (int x = 0; x < getWidth(); x++) {
+                out[x] = (77 * rgb[x * 3 + 0] + 150 * rgb[x * 3 + 1] + 29 * rgb[x * 3 + 2] + 128) >> 8;
+            }
+        }
+        return finish();
+    }
+
+private:
+
+    void* mapping;
+    size_t size;
+    ImageDecoder decoder;
+    std::vector<unsigned char> row;
+};
+
+int main(int argc, char** argv) {
+
+    if (argc != 4) {
+        printf("usage: %s output.png color-image alpha-image\n", argv[0]);
+        return 1;
+    }
+
+    SourceImage color;
+    SourceImage alpha;
+    if (!color.open(argv[2]) || !alpha.open(argv[3])) {
+        return 1;
+    }
+    int width = color.getWidth();
+    int height = color.getHeight();
+    int alphaWidth = alpha.getWidth();
+    int alphaHeight = alpha.getHeight();
+    std::vector<unsigned char> luminance;
+    if (!alpha.readLuminance(luminance)) {
+        printf("Could not decode %s\n", argv[3]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[1], "wb");
+    if (out == nullptr) {
+        printf("Could not open %s for writing\n", argv[1]);
+        return 1;
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop pngInfo = png_create_info_struct(png);
+    std::vector<unsigned char> packed((size_t) width * 4);
+    bool packedAll = false;
+    if (setjmp(png_jmpbuf(png)) == 0) {
+        png_init_io(png, out);
+        png_set_IHDR(png, pngInfo, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, pngInfo);
+        int y = 0;
+        for (; y < height; y++) {
+            const unsigned char* colorRow = color.readRow();
+            if (colorRow == nullptr) {
+                break;
+            }
+            // bilinear filtering between the texel centers of both images,
+            // a plain copy when they have the same size
+            float sy = std::max(0.0f, (y + 0.5f) * alphaHeight / height - 0.5f);
+            int y0 = std::min((int) sy, alphaHeight - 1);
+            int y1 = std::min(y0 + 1, alphaHeight - 1);
+            float fy = sy - y0;
+            for (int x = 0; x < width; x++) {
+                float sx = std::max(0.0f, (x + 0.5f) * alphaWidth / width - 0.5f);
+                int x0 = std::min((int) sx, alphaWidth - 1);
+                int x1 = std::min(x0 + 1, alphaWidth - 1);
+                float fx = sx - x0;
+                const unsigned char* row0 = &luminance[(size_t) y0 * alphaWidth];
+                const unsigned char* row1 = &luminance[(size_t) y1 * alphaWidth];
+                float top = row0[x0] + (row0[x1] - row0[x0]) * fx;
+                float bottom = row1[x0] + (row1[x1] - row1[x0]) * fx;
+                packed[x * 4 + 0] = colorRow[x * 3 + 0];
+                packed[x * 4 + 1] = colorRow[x * 3 + 1];
+                packed[x * 4 + 2] = colorRow[x * 3 + 2];
+                packed[x * 4 + 3] = (unsigned char) (top + (bottom - top) * fy + 0.5f);
+            }
+            png_write_row(png, packed.data());
+        }
+        if (y == height) {
+            png_write_end(png, pngInfo);
+            packedAll = true;
+        }
+    }
+    png_destroy_write_struct(&png, &pngInfo);
+    packedAll = color.finish() && packedAll;
+    packedAll = fclose(out) == 0 && packedAll;
+    if (!packedAll) {
+        printf("Could not write %s\n", argv[1]);
+        remove(argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,282 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXELS_X86
+#endif
+
+/*
+ * Conversions of 8 bit pixels, as needed between image decoders, GL and
+ * image files: vertical flip, RGB <-> RGBA, BGRA <-> RGBA and alpha
+ * premultiplication.
+ *
+ * Each kernel works on a span of pixels, so that a loader can run it on the
+ * rows it has just decoded while they are still in the cache, rather than in
+ * a pass of its own over the whole image. They use AVX2 when the CPU has it,
+ * which is checked at run time as the tutorials are built for plain x86-64,
+ * and SSE2 or SSSE3 otherwise. parallelRows() spreads the rows of a whole
+ * image over threads.
+ */
+
+#ifdef PIXELS_X86
+inline bool cpuHasAVX2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+inline bool cpuHasSSSE3() {
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    return ssse3;
+}
+#endif
+
+// calls rows(first, last) on bands of [0, count) from as many threads as
+// there are cores; small images are not worth the threads
+template <typename F>
+void parallelRows(int count, size_t rowBytes, F rows) {
+    int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = (int) std::min((size_t) threadCount, (size_t) count * rowBytes / (256 * 1024) + 1);
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(rows, count * i / threadCount, count * (i + 1) / threadCount));
+    }
+    rows(0, count / threadCount);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+// premultiplied = (color * alpha + 127) / 255, exactly, for count RGBA pixels;
+// src and dst may be the same
+#ifdef PIXELS_X86
+__attribute__((target("avx2")))
+inline size_t premultiplyAlphaAVX2(const unsigned char* src, unsigned char* dst, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    // the alpha lanes are multiplied by 255, which leaves them as they are
+    const __m256i alphaLanes = _mm256_set1_epi64x(0xffff000000000000ll);
+    const __m256i opaque = _mm256_set1_epi16(255);
+    const __m256i half = _mm256_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*) (src + i * 4));
+        __m256i result[2];
+        for (int h = 0; h < 2; h++) {
+            __m256i c = h == 0 ? _mm256_unpacklo_epi8(pixels, zero) : _mm256_unpackhi_epi8(pixels, zero);
+            __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xff), 0xff);
+            a = _mm256_blendv_epi8(a, opaque, alphaLanes);
+            // x / 255 rounded is (t + (t >> 8)) >> 8 with t = x + 128
+            __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(c, a), half);
+            result[h] = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+        }
+        _mm256_storeu_si256((__m256i*) (dst + i * 4), _mm256_packus_epi16(result[0], result[1]));
+    }
+    return i;
+}
+#endif
+
+#ifdef __SSE2__
+inline size_t premultiplyAlphaSSE2(const unsigned char* src, unsigned char* dst, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i opaque = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) (src + i * 4));
+        __m128i result[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i c = h == 0 ? _mm_unpacklo_epi8(pixels, zero) : _mm_unpackhi_epi8(pixels, zero);
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xff), 0xff);
+            a = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), _mm_and_si128(alphaLanes, opaque));
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), half);
+            result[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        }
+        _mm_storeu_si128((__m128i*) (dst + i * 4), _mm_packus_epi16(result[0], result[1]));
+    }
+    return i;
+}
+#endif
+
+inline void premultiplyAlpha(const unsigned char* src, unsigned char* dst, size_t count) {
+    size_t i = 0;
+#ifdef PIXELS_X86
+    if (cpuHasAVX2()) {
+        i = premultiplyAlphaAVX2(src, dst, count);
+    }
+#endif
+#ifdef __SSE2__
+    i += premultiplyAlphaSSE2(src + i * 4, dst + i * 4, count - i);
+#endif
+    for (; i < count; i++) {
+        int a = src[i * 4 + 3];
+        for (int c = 0; c < 3; c++) {
+            int t = src[i * 4 + c] * a + 128;
+            dst[i * 4 + c] = (t + (t >> 8)) >> 8;
+        }
+        dst[i * 4 + 3] = a;
+    }
+}
+
+// swaps the red and blue channels of count 4 byte pixels, which turns BGRA
+// into RGBA and back; src and dst may be the same
+#ifdef PIXELS_X86
+__attribute__((target("avx2")))
+inline size_t swapRedBlueAVX2(const unsigned char* src, unsigned char* dst, size_t count) {
+    const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*) (src + i * 4));
+        _mm256_storeu_si256((__m256i*) (dst + i * 4), _mm256_shuffle_epi8(pixels, order));
+    }
+    return i;
+}
+#endif
+
+#ifdef __SSE2__
+inline size_t swapRedBlueSSE2(const unsigned char* src, unsigned char* dst, size_t count) {
+    // green and alpha stay, red and blue move by 16 bits within each pixel
+    const __m128i greenAlpha = _mm_set1_epi32(0xff00ff00);
+    const __m128i low = _mm_set1_epi32(0x000000ff);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*) (src + i * 4));
+        __m128i swapped = _mm_or_si128(_mm_and_si128(pixels, greenAlpha),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16), low), _mm_slli_epi32(_mm_and_si128(pixels, low), 16)));
+        _mm_storeu_si128((__m128i*) (dst + i * 4), swapped);
+    }
+    return i;
+}
+#endif
+
+inline void swapRedBlue(const unsigned char* src, unsigned char* dst, size_t count) {
+    size_t i = 0;
+#ifdef PIXELS_X86
+    if (cpuHasAVX2()) {
+        i = swapRedBlueAVX2(src, dst, count);
+    }
+#endif
+#ifdef __SSE2__
+    i += swapRedBlueSSE2(src + i * 4, dst + i * 4, count - i);
+#endif
+    for (; i < count; i++) {
+        unsigned char r = src[i * 4 + 0];
+        dst[i * 4 + 0] = src[i * 4 + 2];
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = r;
+        dst[i * 4 + 3] = src[i * 4 + 3];
+    }
+}
+
+// widens count RGB pixels to RGBA with an alpha of 255; src and dst must not
+// overlap
+#ifdef PIXELS_X86
+__attribute__((target("avx2")))
+inline size_t expandRGBToRGBAAVX2(const unsigned char* src, unsigned char* dst, size_t count) {
+    // the 24 bytes of 8 pixels go to both halves, 12 bytes each, as
+    // _mm256_shuffle_epi8 does not cross them
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i order = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+    size_t i = 0;
+    // the load reads 32 bytes for 24, so the last pixels are left to the others
+    for (; i + 11 <= count; i += 8) {
+        __m256i rgb = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*) (src + i * 3)), spread);
+        _mm256_storeu_si256((__m256i*) (dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, order), alpha));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+inline size_t expandRGBToRGBASSSE3(const unsigned char* src, unsigned char* dst, size_t count) {
+    const __m128i order = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    size_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i rgb = _mm_loadu_si128((const __m128i*) (src + i * 3));
+        _mm_storeu_si128((__m128i*) (dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, order), alpha));
+    }
+    return i;
+}
+#endif
+
+inline void expandRGBToRGBA(const unsigned char* src, unsigned char* dst, size_t count) {
+    size_t i = 0;
+#ifdef PIXELS_X86
+    if (cpuHasAVX2()) {
+        i = expandRGBToRGBAAVX2(src, dst, count);
+    }
+    if (cpuHasSSSE3()) {
+        i += expandRGBToRGBASSSE3(src + i * 3, dst + i * 4, count - i);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 255;
+    }
+}
+
+// drops the alpha channel of count RGBA pixels; src and dst may be the same
+#ifdef PIXELS_X86
+__attribute__((target("avx2")))
+inline size_t packRGBAToRGBAVX2(const unsigned char* src, unsigned char* dst, size_t count) {
+    const __m256i order = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i rgba = _mm256_loadu_si256((const __m256i*) (src + i * 4));
+        __m256i rgb = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(rgba, order), gather);
+        // exactly 24 bytes, the next ones may be pixels not read yet
+        _mm_storeu_si128((__m128i*) (dst + i * 3), _mm256_castsi256_si128(rgb));
+        _mm_storel_epi64((__m128i*) (dst + i * 3 + 16), _mm256_extracti128_si256(rgb, 1));
+    }
+    return i;
+}
+#endif
+
+inline void packRGBAToRGB(const unsigned char* src, unsigned char* dst, size_t count) {
+    size_t i = 0;
+#ifdef PIXELS_X86
+    if (cpuHasAVX2()) {
+        i = packRGBAToRGBAVX2(src, dst, count);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i * 3 + 0] = src[i * 4 + 0];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4 + 2];
+    }
+}
+
+// swaps the rows of an image from top to bottom, in place
+inline void flipRows(unsigned char* pixels, size_t stride, int height) {
+    parallelRows(height / 2, stride * 2, [=](int first, int last) {
+        for (int y = first; y < last; y++) {
+            unsigned char* top = pixels + y * stride;
+            unsigned char* bottom = pixels + (height - 1 - y) * stride;
+            size_t x = 0;
+#ifdef __SSE2__
+            for (; x + 16 <= stride; x += 16) {
+                __m128i a = _mm_loadu_si128((const __m128i*) (top + x));
+                __m128i b = _mm_loadu_si128((const __m128i*) (bottom + x));
+                _mm_storeu_si128((__m128i*) (top + x), b);
+                _mm_storeu_si128((__m128i*) (bottom + x), a);
+            }
+#endif
+            for (; x < stride; x++) {
+                std::swap(top[x], bottom[x]);
+            }
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "tracer.h"
+
+/*
+ * Rendering on a thread of its own, which owns the GL context, for the
+ * toolkits whose main loop would otherwise render between two events: the
+ * frames then wait for the dispatch of the events, and the events for the
+ * frames, and both jitter.
+ *
+ *     renderThread.start(begin, render, end, reshape, keyPress);
+ *     renderThread.postResize(width, height);   // from the event handlers
+ *     renderThread.postKey(keyval);
+ *     renderThread.stop();                      // when the main loop is over
+ *
+ * The main loop only posts to the channel, which never blocks it for longer
+ * than a copy. The render thread drains the channel before each frame: the
+ * sizes posted since the previous frame come down to the last one, the keys
+ * are handed over in order. begin() makes the context current on the render
+ * thread and end() releases it, with the GL objects, once stop() is called.
+ *
+ * The callbacks run on the render thread, where the toolkit must not be
+ * called; they hand their results back to the main loop with g_idle_add,
+ * which is thread safe. Xlib must be made thread safe before the toolkit
+ * opens the display, the render thread swapping on the same connection.
+ */
+
+class RenderThread {
+
+public:
+
+    RenderThread() : running(false), stopping(false), paused(false), resized(false), width(0), height(0) {}
+
+    ~RenderThread() {
+        stop();
+    }
+
+    // begin returns false when the context cannot be made current, the
+    // thread then ends without rendering
+    void start(bool (*begin)(), void (*render)(), void (*end)(), void (*reshape)(int, int), void (*keyPress)(unsigned)) {
+        if (running) {
+            return;
+        }
+        this->begin = begin;
+        this->render = render;
+        this->end = end;
+        this->reshape = reshape;
+        this->keyPress = keyPress;
+        stopping = false;
+        running = true;
+        thread = std::thread(&RenderThread::run, this);
+    }
+
+    bool started() const {
+        return running;
+    }
+
+    // the size of the drawable changed; only the last size before a frame
+    // is applied
+    void postResize(int width, int height) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->width = width;
+            this->height = height;
+            resized = true;
+        }
+        condition.notify_one();
+    }
+
+    void postKey(unsigned keyval) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            keys.push_back(keyval);
+        }
+        condition.notify_one();
+    }
+
+    // stops rendering, while the window is unmapped typically; the posted
+    // events are still handed over
+    void setPaused(bool paused) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->paused = paused;
+        }
+        condition.notify_one();
+    }
+
+    // has the thread run end() and waits for it
+    void stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_one();
+        thread.join();
+        running = false;
+    }
+
+private:
+
+    std::thread thread;
+    bool running;
+    bool (*begin)();
+    void (*render)();
+    void (*end)();
+    void (*reshape)(int, int);
+    void (*keyPress)(unsigned);
+
+    // the channel, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+    bool paused;
+    bool resized;
+    int width;
+    int height;
+    std::vector<unsigned> keys;
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    void run() {
+        Tracer::instance().setThreadName("render");
+        if (!begin()) {
+            return;
+        }
+        std::vector<unsigned> pendingKeys;
+        for (;;) {
+            bool resize;
+            int resizeWidth;
+            int resizeHeight;
+            bool rendering;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !paused || resized || !keys.empty(); });
+                if (stopping) {
+                    break;
+                }
+                resize = resized;
+                resizeWidth = width;
+                resizeHeight = height;
+                resized = false;
+                pendingKeys.swap(keys);
+                rendering = !paused;
+            }
+            if (resize) {
+                reshape(resizeWidth, resizeHeight);
+            }
+            for (size_t i = 0; i < pendingKeys.size(); i++) {
+                keyPress(pendingKeys[i]);
+            }
+            pendingKeys.clear();
+            if (rendering) {
+                render();
+            }
+        }
+        end();
+    }
+};
+
+#endif
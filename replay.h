@@ -0,0 +1,228 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "frameclock.h"
+
+/*
+ * Sessions that render the same frames every time. The animations derive
+ * their angles from the wall time, so that no two runs draw the same frames;
+ * with a virtual clock the time of a frame is its number times a fixed step:
+ *
+ *     ./tutorial09 -headless 300 -step 16.667 -report run.json
+ *
+ * and the input that changes the scene is recorded with the number of the
+ * frame it went before, to be replayed before the same frame:
+ *
+ *     ./tutorial11 -record session.txt
+ *     ./tutorial11 -replay session.txt
+ *     ./tutorial11 -replay session.txt -headless 600 -timings frames.txt
+ *
+ * Recording and replaying run on the virtual clock, at the step of the
+ * recording unless -step is given, 60 frames per second by default. While
+ * replaying, the input of the window is dropped but for closing it, and the
+ * replay ends at the frame the recording did; headless, it ends after the
+ * frames asked for. The recording is a text file, one event per line:
+ *
+ *     step 16.666667
+ *     0 r 800 600          // frame, type, key or width, height
+ *     212 d 273 0
+ *     598 q 0 0
+ *
+ * The loops record the events they handle with record(), on the thread that
+ * renders, and apply the replayed ones that poll() hands over before each
+ * frame; render() reads the time of the frame from now() and calls
+ * endFrame() once it is swapped.
+ */
+
+struct ReplayEvent {
+
+    enum Type {
+        KEY_DOWN = 'd',
+        RESIZE = 'r',
+        QUIT = 'q'
+    };
+
+    long frame;
+    int type;
+    // the key, or the width
+    int x;
+    // the height
+    int y;
+};
+
+class Replay {
+
+public:
+
+    Replay() : stepMillis(0.0), frame(0), file(nullptr), next(0), quitFrame(-1) {}
+
+    ~Replay() {
+        finish();
+    }
+
+    // takes "-step ms", "-record path" and "-replay path" out of the
+    // arguments
+    void parseArguments(int& argc, char** argv) {
+        int kept = 1;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-step") == 0 && i + 1 < argc) {
+                stepMillis = std::max(0.0, atof(argv[++i]));
+            } else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc) {
+                recordPath = argv[++i];
+            } else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc) {
+                replayPath = argv[++i];
+            } else {
+                argv[kept++] = argv[i];
+            }
+        }
+        argc = kept;
+        argv[argc] = nullptr;
+    }
+
+    // reads the replay and opens the recording, false when either fails
+    bool start() {
+        if (!replayPath.empty() && !load(replayPath)) {
+            return false;
+        }
+        if (!recordPath.empty()) {
+            if (replaying()) {
+                printf("Cannot record while replaying, %s is left alone\n", recordPath.c_str());
+                recordPath.clear();
+            } else {
+                file = fopen(recordPath.c_str(), "w");
+                if (file == nullptr) {
+                    printf("Cannot write %s\n", recordPath.c_str());
+                    return false;
+                }
+            }
+        }
+        if (stepMillis <= 0.0 && (recording() || replaying())) {
+            stepMillis = 1000.0 / 60;
+        }
+        if (recording()) {
+            fprintf(file, "step %f\n", stepMillis);
+            printf("Recording to %s, %.3f ms per frame\n", recordPath.c_str(), stepMillis);
+        } else if (replaying()) {
+            printf("Replaying %d events of %s, %.3f ms per frame\n", (int) events.size(), replayPath.c_str(), stepMillis);
+        }
+        return true;
+    }
+
+    // true when the time of a frame comes from its number
+    bool fixedStep() const {
+        return stepMillis > 0.0;
+    }
+
+    bool recording() const {
+        return file != nullptr;
+    }
+
+    bool replaying() const {
+        return !replayPath.empty();
+    }
+
+    // the number of the frame to render next
+    long getFrame() const {
+        return frame;
+    }
+
+    // the time of the frame to render next, in milliseconds: its number
+    // times the step on the virtual clock, the wall time otherwise
+    long now() const {
+        return fixedStep() ? (long) (frame * stepMillis + 0.5) : currentTimeMillis();
+    }
+
+    // once the frame is swapped
+    void endFrame() {
+        frame++;
+    }
+
+    // an event handled before the frame to render next, while recording
+    void record(ReplayEvent::Type type, int x = 0, int y = 0) {
+        if (file != nullptr) {
+            fprintf(file, "%ld %c %d %d\n", frame, (char) type, x, y);
+        }
+    }
+
+    // hands over the next event recorded before the frame to render next,
+    // false when there is none left for it
+    bool poll(ReplayEvent& event) {
+        if (next >= events.size() || events[next].frame > frame) {
+            return false;
+        }
+        event = events[next++];
+        return true;
+    }
+
+    // true once the replay reached the frame the recording ended at
+    bool ended() const {
+        return quitFrame >= 0 && frame >= quitFrame;
+    }
+
+    // closes the recording with the frame it ended at
+    void finish() {
+        if (file != nullptr) {
+            record(ReplayEvent::QUIT);
+            fclose(file);
+            file = nullptr;
+            printf("Recorded %ld frames to %s\n", frame, recordPath.c_str());
+        }
+    }
+
+private:
+
+    double stepMillis;
+    long frame;
+    std::string recordPath;
+    std::string replayPath;
+    FILE* file;
+    // the events to replay in the order of their frames, but the quit
+    std::vector<ReplayEvent> events;
+    size_t next;
+    long quitFrame;
+
+    Replay(const Replay&) = delete;
+    Replay& operator=(const Replay&) = delete;
+
+    bool load(const std::string& path) {
+        FILE* input = fopen(path.c_str(), "r");
+        if (input == nullptr) {
+            printf("Cannot read %s\n", path.c_str());
+            return false;
+        }
+        double recordedStep = 0.0;
+        if (fscanf(input, " step %lf", &recordedStep) != 1 || recordedStep <= 0.0) {
+            printf("%s is not a recording\n", path.c_str());
+            fclose(input);
+            return false;
+        }
+        if (stepMillis <= 0.0) {
+            stepMillis = recordedStep;
+        }
+        ReplayEvent event;
+        char type;
+        while (fscanf(input, " %ld %c %d %d", &event.frame, &type, &event.x, &event.y) == 4) {
+            event.type = type;
+            if (event.type == ReplayEvent::QUIT) {
+                quitFrame = event.frame;
+            } else if (events.empty() || events.back().frame <= event.frame) {
+                events.push_back(event);
+            }
+        }
+        bool complete = feof(input) != 0;
+        fclose(input);
+        if (!complete) {
+            printf("%s is damaged after %d events\n", path.c_str(), (int) events.size());
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
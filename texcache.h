@@ -0,0 +1,243 @@
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/*
+ * A disk cache for textures, so that only the first run pays for decoding
+ * the images, filtering the mip levels and compressing them. The cache file
+ * is laid out like a KTX file: a header describing the texture, followed by
+ * each mip level exactly as glTexSubImage2D or glCompressedTexSubImage2D
+ * takes it. Later runs map the file and hand GL pointers into the mapping,
+ * so the levels go from the page cache to the driver without being copied
+ * or even read by the program.
+ *
+ * The header records a hash of the source image: when the image changes, the
+ * cache no longer matches and is rewritten on the next load. A file is only
+ * mapped when each of its levels has exactly the size its format, its
+ * dimensions and its faces call for, so GL never reads past the mapping.
+ */
+
+const int TEXTURE_CACHE_MAX_LEVELS = 16;
+
+struct TextureCacheHeader {
+    char magic[8];
+    uint64_t sourceHash;
+    uint32_t internalFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    // the images per level, one after the other: 6 for a cube map
+    uint32_t faces;
+    // from the start of the file, every level starts on a 16 byte boundary
+    uint64_t levelOffsets[TEXTURE_CACHE_MAX_LEVELS];
+    uint64_t levelSizes[TEXTURE_CACHE_MAX_LEVELS];
+};
+
+const char TEXTURE_CACHE_MAGIC[8] = { 'C', 'G', 'L', 'T', 'E', 'X', '2', '\n' };
+
+// 64 bit FNV-1a, enough to notice that a source image was edited
+inline uint64_t hashBytes(const unsigned char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// the cache of an image goes next to it in CGLCORE_ASSET_DIR when the assets
+// are read from there; when they are embedded, in $XDG_CACHE_HOME/cglcore or
+// ~/.cache/cglcore rather than in whatever the working directory is, and
+// nowhere, an empty path, when there is no home either
+inline std::string textureCachePath(const std::string& imageFile) {
+    const char* dir = getenv("CGLCORE_ASSET_DIR");
+    if (dir != nullptr && *dir != 0) {
+        return std::string(dir) + "/" + imageFile + ".texcache";
+    }
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cacheHome != nullptr && *cacheHome == '/') {
+        return std::string(cacheHome) + "/cglcore/" + imageFile + ".texcache";
+    }
+    if (home != nullptr && *home != 0) {
+        return std::string(home) + "/.cache/cglcore/" + imageFile + ".texcache";
+    }
+    return std::string();
+}
+
+class TextureCacheFile {
+
+public:
+
+    TextureCacheFile() : mapping(nullptr), mappedSize(0) {}
+
+    ~TextureCacheFile() {
+        close();
+    }
+
+    // maps the cache file, which is only accepted if it was written for
+    // the source image with the given hash
+    bool open(const std::string& path, uint64_t sourceHash) {
+        close();
+        if (path.empty()) {
+            return false;
+        }
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TextureCacheHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps the file alive
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        mapping = (const unsigned char*) address;
+        mappedSize = st.st_size;
+        if (!validate(sourceHash)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (mapping != nullptr) {
+            munmap((void*) mapping, mappedSize);
+            mapping = nullptr;
+            mappedSize = 0;
+        }
+    }
+
+    uint32_t getInternalFormat() const { return header()->internalFormat; }
+    int getWidth() const { return header()->width; }
+    int getHeight() const { return header()->height; }
+    int getLevels() const { return header()->levels; }
+    int getFaces() const { return header()->faces; }
+    const unsigned char* getLevel(int level) const { return mapping + header()->levelOffsets[level]; }
+    size_t getLevelSize(int level) const { return header()->levelSizes[level]; }
+
+    // writes the levels to a temporary file renamed over the cache, so that a
+    // run that is interrupted never leaves a truncated cache behind; each
+    // level holds its faces one after the other. The directories of the path
+    // are made when missing
+    static bool write(const std::string& path, uint64_t sourceHash, uint32_t internalFormat, int width, int height,
+            int faces, const std::vector<std::vector<unsigned char> >& levels) {
+        if (path.empty() || levels.empty() || levels.size() > (size_t) TEXTURE_CACHE_MAX_LEVELS || faces <= 0) {
+            return false;
+        }
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (levels[i].size() != levelSize(internalFormat, width, height, faces, i)) {
+                return false;
+            }
+        }
+        TextureCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(header.magic));
+        header.sourceHash = sourceHash;
+        header.internalFormat = internalFormat;
+        header.width = width;
+        header.height = height;
+        header.levels = levels.size();
+        header.faces = faces;
+        uint64_t offset = align(sizeof(header));
+        for (size_t i = 0; i < levels.size(); i++) {
+            header.levelOffsets[i] = offset;
+            header.levelSizes[i] = levels[i].size();
+            offset = align(offset + levels[i].size());
+        }
+
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        }
+        std::string temporaryPath = path + ".tmp";
+        FILE* file = fopen(temporaryPath.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        static const unsigned char padding[16] = { 0 };
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        uint64_t position = sizeof(header);
+        for (size_t i = 0; written && i < levels.size(); i++) {
+            written = fwrite(padding, 1, header.levelOffsets[i] - position, file) == header.levelOffsets[i] - position
+                && fwrite(levels[i].data(), 1, levels[i].size(), file) == levels[i].size();
+            position = header.levelOffsets[i] + levels[i].size();
+        }
+        written = fclose(file) == 0 && written;
+        if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+
+    const unsigned char* mapping;
+    size_t mappedSize;
+
+    TextureCacheFile(const TextureCacheFile&) = delete;
+    TextureCacheFile& operator=(const TextureCacheFile&) = delete;
+
+    const TextureCacheHeader* header() const {
+        return (const TextureCacheHeader*) mapping;
+    }
+
+    static uint64_t align(uint64_t offset) {
+        return (offset + 15) & ~(uint64_t) 15;
+    }
+
+    // the bytes of the faces of a mip level, 0 for a format the cache does
+    // not know, see texcompress.h for the block sizes
+    static uint64_t levelSize(uint32_t internalFormat, uint32_t width, uint32_t height, uint32_t faces, uint32_t level) {
+        uint64_t levelWidth = width >> level > 0 ? width >> level : 1;
+        uint64_t levelHeight = height >> level > 0 ? height >> level : 1;
+        uint64_t blocks = ((levelWidth + 3) / 4) * ((levelHeight + 3) / 4);
+        switch (internalFormat) {
+        case GL_RGBA8:
+            return levelWidth * levelHeight * 4 * faces;
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1:
+            return blocks * 8 * faces;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return blocks * 16 * faces;
+        default:
+            return 0;
+        }
+    }
+
+    bool validate(uint64_t sourceHash) const {
+        const TextureCacheHeader* h = header();
+        // the bounds on the dimensions and faces keep the level sizes from overflowing
+        if (memcmp(h->magic, TEXTURE_CACHE_MAGIC, sizeof(h->magic)) != 0 || h->sourceHash != sourceHash
+                || h->levels == 0 || h->levels > (uint32_t) TEXTURE_CACHE_MAX_LEVELS || h->faces == 0
+                || h->width == 0 || h->height == 0 || h->width > 65536 || h->height > 65536 || h->faces > 6) {
+            return false;
+        }
+        for (uint32_t i = 0; i < h->levels; i++) {
+            uint64_t size = levelSize(h->internalFormat, h->width, h->height, h->faces, i);
+            if (size == 0 || h->levelSizes[i] != size
+                    || h->levelOffsets[i] > mappedSize || h->levelSizes[i] > mappedSize - h->levelOffsets[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef TEXCOMPRESS_H
+#define TEXCOMPRESS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "tracer.h"
+
+/*
+ * Block compression of RGBA8 images into the BC1 (DXT1, 4 bits per texel, for
+ * color), BC4 (RGTC1, 4 bits per texel, for a single channel) and BC3 (DXT5,
+ * 8 bits per texel, a BC1 color block and a BC4 block for alpha) GPU formats.
+ * It follows the approach of J.M.P. van Waveren's "Real-Time DXT Compression":
+ * the endpoints are the corners of the color bounding box, inset a little, and
+ * each texel gets the nearest palette entry. The distances are computed with
+ * SSE2 four texels at a time, and the rows of blocks are spread over threads.
+ */
+
+enum BlockFormat {
+    BLOCK_NONE,
+    BLOCK_BC1,
+    BLOCK_BC4,
+    BLOCK_BC3
+};
+
+// bytes per 4x4 block
+inline int blockSize(BlockFormat format) {
+    return format == BLOCK_BC3 ? 16 : 8;
+}
+
+// bytes needed for a width x height image
+inline size_t blockCompressedSize(BlockFormat format, int width, int height) {
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+// copies the 4x4 block at (bx, by), repeating the last row and column when
+// the image size is not a multiple of 4
+inline void fetchBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[64]) {
+    for (int y = 0; y < 4; y++) {
+        int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            int sx = std::min(bx * 4 + x, width - 1);
+            memcpy(block + (y * 4 + x) * 4, rgba + ((size_t) sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+inline unsigned short packRGB565(int r, int g, int b) {
+    return (unsigned short) (((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+// expands a 565 color back to 8 bits per channel, the way the GPU does
+inline void unpackRGB565(unsigned short c, int rgb[3]) {
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// the texel-to-palette assignment of BC1, 2 bits per texel; palette holds 4 RGBX colors
+inline unsigned int bc1Indices(const unsigned char block[64], const int palette[4][3]) {
+    unsigned int indices = 0;
+#ifdef __SSE2__
+    const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i colors[4];
+    for (int k = 0; k < 4; k++) {
+        colors[k] = _mm_setr_epi16(palette[k][0], palette[k][1], palette[k][2], 0,
+                                   palette[k][0], palette[k][1], palette[k][2], 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        __m128i texels = _mm_and_si128(_mm_loadu_si128((const __m128i*) (block + i * 16)), rgbMask);
+        __m128i lo = _mm_unpacklo_epi8(texels, zero);
+        __m128i hi = _mm_unpackhi_epi8(texels, zero);
+        __m128i distances[4];
+        for (int k = 0; k < 4; k++) {
+            // madd gives (dr*dr + dg*dg, db*db) per texel; adding the pairs gives the distance
+            __m128i dlo = _mm_sub_epi16(lo, colors[k]);
+            __m128i dhi = _mm_sub_epi16(hi, colors[k]);
+            __m128 slo = _mm_castsi128_ps(_mm_madd_epi16(dlo, dlo));
+            __m128 shi = _mm_castsi128_ps(_mm_madd_epi16(dhi, dhi));
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(3, 1, 3, 1)));
+            distances[k] = _mm_add_epi32(even, odd);
+        }
+        // pick the closest entry, the first one on ties
+        __m128i best = distances[0];
+        __m128i index = zero;
+        for (int k = 1; k < 4; k++) {
+            __m128i closer = _mm_cmplt_epi32(distances[k], best);
+            best = _mm_or_si128(_mm_and_si128(closer, distances[k]), _mm_andnot_si128(closer, best));
+            index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, index));
+        }
+        int lanes[4];
+        _mm_storeu_si128((__m128i*) lanes, index);
+        for (int j = 0; j < 4; j++) {
+            indices |= (unsigned int) lanes[j] << (2 * (i * 4 + j));
+        }
+    }
+#else
+    for (int i = 0; i < 16; i++) {
+        const unsigned char* t = block + i * 4;
+        int bestDistance = 0x7fffffff;
+        int bestIndex = 0;
+        for (int k = 0; k < 4; k++) {
+            int dr = t[0] - palette[k][0];
+            int dg = t[1] - palette[k][1];
+            int db = t[2] - palette[k][2];
+            int d = dr * dr + dg * dg + db * db;
+            if (d < bestDistance) {
+                bestDistance = d;
+                bestIndex = k;
+            }
+        }
+        indices |= (unsigned int) bestIndex << (2 * i);
+    }
+#endif
+    return indices;
+}
+
+inline void encodeBC1Block(const unsigned char block[64], unsigned char out[8]) {
+    unsigned char mn[4], mx[4];
+#ifdef __SSE2__
+    __m128i lo = _mm_loadu_si128((const __m128i*) block);
+    __m128i hi = lo;
+    for (int i = 1; i < 4; i++) {
+        __m128i row = _mm_loadu_si128((const __m128i*) (block + i * 16));
+        lo = _mm_min_epu8(lo, row);
+        hi = _mm_max_epu8(hi, row);
+    }
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+    int mnBits = _mm_cvtsi128_si32(lo);
+    int mxBits = _mm_cvtsi128_si32(hi);
+    memcpy(mn, &mnBits, 4);
+    memcpy(mx, &mxBits, 4);
+#else
+    memcpy(mn, block, 4);
+    memcpy(mx, block, 4);
+    for (int i = 1; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            mn[c] = std::min(mn[c], block[i * 4 + c]);
+            mx[c] = std::max(mx[c], block[i * 4 + c]);
+        }
+    }
+#endif
+    // moving the endpoints inwards by 1/16 of the range lowers the average error
+    int c0[3], c1[3];
+    for (int c = 0; c < 3; c++) {
+        int inset = (mx[c] - mn[c]) >> 4;
+        c0[c] = std::min(255, mn[c] + inset);
+        c1[c] = std::max(0, mx[c] - inset);
+    }
+    unsigned short color0 = packRGB565(c1[0], c1[1], c1[2]);
+    unsigned short color1 = packRGB565(c0[0], c0[1], c0[2]);
+    unsigned int indices = 0;
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+    if (color0 != color1) {
+        // color0 > color1 selects the 4 color mode
+        int palette[4][3];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        indices = bc1Indices(block, palette);
+    }
+    out[0] = color0 & 0xff;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xff;
+    out[3] = color1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+// encodes one channel of the block, e.g. channel 0 for the red channel
+inline void encodeBC4Block(const unsigned char block[64], int channel, unsigned char out[8]) {
+    unsigned char values[16];
+    for (int i = 0; i < 16; i++) {
+        values[i] = block[i * 4 + channel];
+    }
+    int mn, mx;
+#ifdef __SSE2__
+    __m128i v = _mm_loadu_si128((const __m128i*) values);
+    __m128i lo = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+    __m128i hi = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 2));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 2));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 1));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 1));
+    mn = _mm_cvtsi128_si32(lo) & 0xff;
+    mx = _mm_cvtsi128_si32(hi) & 0xff;
+#else
+    mn = *std::min_element(values, values + 16);
+    mx = *std::max_element(values, values + 16);
+#endif
+    out[0] = mx;
+    out[1] = mn;
+    unsigned long long indices = 0;
+    if (mx > mn) {
+        // with red0 > red1, code 0 is red0, code 1 is red1 and codes 2 to 7
+        // step from red0 towards red1; t is the position from red1 (0) to red0 (7)
+        int t[16];
+#ifdef __SSE2__
+        __m128 scale = _mm_set1_ps(7.0f / (mx - mn));
+        __m128i base = _mm_set1_epi32(mn);
+        __m128i zero = _mm_setzero_si128();
+        __m128i v16 = _mm_unpacklo_epi8(v, zero);
+        __m128i v32[4] = {
+            _mm_unpacklo_epi16(v16, zero), _mm_unpackhi_epi16(v16, zero),
+            _mm_unpacklo_epi16(_mm_unpackhi_epi8(v, zero), zero), _mm_unpackhi_epi16(_mm_unpackhi_epi8(v, zero), zero)
+        };
+        for (int i = 0; i < 4; i++) {
+            __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(v32[i], base)), scale);
+            _mm_storeu_si128((__m128i*) (t + i * 4), _mm_cvtps_epi32(f));
+        }
+#else
+        for (int i = 0; i < 16; i++) {
+            // rounds half to even, like the SSE2 conversion
+            t[i] = (int) lrintf((values[i] - mn) * (7.0f / (mx - mn)));
+        }
+#endif
+        for (int i = 0; i < 16; i++) {
+            unsigned long long code = t[i] == 7 ? 0 : t[i] == 0 ? 1 : 8 - t[i];
+            indices |= code << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (indices >> (8 * i)) & 0xff;
+    }
+}
+
+// compresses a width x height RGBA8 image into out, which must hold
+// blockCompressedSize(format, width, height) bytes; BC4 keeps the red channel
+inline void blockCompress(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out) {
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, blocksY);
+    auto encodeRows = [=](int first, int last) {
+        Tracer::Scope trace("compress rows");
+        unsigned char block[64];
+        for (int by = first; by < last; by++) {
+            for (int bx = 0; bx < blocksX; bx++) {
+                unsigned char* dst = out + ((size_t) by * blocksX + bx) * blockSize(format);
+                fetchBlock(rgba, width, height, bx, by, block);
+                if (format == BLOCK_BC1) {
+                    encodeBC1Block(block, dst);
+                } else if (format == BLOCK_BC4) {
+                    encodeBC4Block(block, 0, dst);
+                } else {
+                    // the alpha block comes first
+                    encodeBC4Block(block, 3, dst);
+                    encodeBC1Block(block, dst + 8);
+                }
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(encodeRows, blocksY * i / threadCount, blocksY * (i + 1) / threadCount));
+    }
+    encodeRows(0, blocksY / threadCount);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+// box filters an RGBA8 image down to the next mip level, which is width/2 x
+// height/2 but never less than 1 texel, like the levels GL expects
+inline void downsampleRGBA(const unsigned char* src, int width, int height, unsigned char* dst) {
+    int w = std::max(1, width / 2);
+    int h = std::max(1, height / 2);
+    for (int y = 0; y < h; y++) {
+        const unsigned char* row0 = src + (size_t) std::min(2 * y, height - 1) * width * 4;
+        const unsigned char* row1 = src + (size_t) std::min(2 * y + 1, height - 1) * width * 4;
+        for (int x = 0; x < w; x++) {
+            int x0 = std::min(2 * x, width - 1) * 4;
+            int x1 = std::min(2 * x + 1, width - 1) * 4;
+            for (int c = 0; c < 4; c++) {
+                dst[((size_t) y * w + x) * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+            }
+        }
+    }
+}
+
+#endif
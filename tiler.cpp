@@ -0,0 +1,250 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include "image.h"
+#include "texcompress.h"
+#include "tilestore.h"
+
+/*
+ * Build tool that cuts an image into a tile store, see tilestore.h.
+ *
+ *     tiler earth_day.jpg earth_day.tiles
+ *
+ * The image is decoded one row at a time and never held in memory as a
+ * whole: each level of the pyramid keeps a ring of the rows its current row
+ * of tiles needs, cuts the tiles out of it as soon as their last row arrives,
+ * and hands every pair of rows, averaged, to the next coarser level. Tiles
+ * are stored as JPEG. Their borders wrap around horizontally, as the image is
+ * a map of the whole earth, and repeat the edge rows vertically.
+ */
+
+const int TILE_SIZE = 120;
+const int TILE_BORDER = 4;
+const int PAGE_SIZE = TILE_SIZE + 2 * TILE_BORDER;
+const int TILE_QUALITY = 90;
+
+int nextPowerOfTwo(int n) {
+    int p = 1;
+    while (p < n) {
+        p *= 2;
+    }
+    return p;
+}
+
+int floorLog2(int n) {
+    int l = 0;
+    while (n > 1) {
+        n /= 2;
+        l++;
+    }
+    return l;
+}
+
+class TileWriter {
+
+public:
+
+    TileWriter(FILE* out, const TileStoreHeader& header) : out(out), header(header), position(sizeof(header)), tilesWritten(0), failed(false) {
+        index.resize(tileIndexBase(header, header.levels));
+        memset(index.data(), 0, index.size() * sizeof(TileIndexEntry));
+        compressor.err = jpeg_std_error(&errorManager);
+        jpeg_create_compress(&compressor);
+    }
+
+    ~TileWriter() {
+        jpeg_destroy_compress(&compressor);
+    }
+
+    // compresses a tile of PAGE_SIZE x PAGE_SIZE RGB pixels and appends it
+    void write(int level, int x, int y, const unsigned char* pixels) {
+        unsigned char* encoded = nullptr;
+        unsigned long encodedSize = 0;
+        jpeg_mem_dest(&compressor, &encoded, &encodedSize);
+        compressor.image_width = PAGE_SIZE;
+        compressor.image_height = PAGE_SIZE;
+        compressor.input_components = 3;
+        compressor.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&compressor);
+        jpeg_set_quality(&compressor, TILE_QUALITY, TRUE);
+        jpeg_start_compress(&compressor, TRUE);
+        while (compressor.next_scanline < compressor.image_height) {
+            JSAMPROW row = (JSAMPROW) pixels + compressor.next_scanline * PAGE_SIZE * 3;
+            jpeg_write_scanlines(&compressor, &row, 1);
+        }
+        jpeg_finish_compress(&compressor);
+
+        TileIndexEntry& entry = index[tileIndexBase(header, level) + (size_t) y * levelTiles(header.tilesX, level) + x];
+        entry.offset = position;
+        entry.size = encodedSize;
+        failed = failed || fwrite(encoded, 1, encodedSize, out) != encodedSize;
+        position += encodedSize;
+        tilesWritten++;
+        free(encoded);
+    }
+
+    // appends the index and completes the header
+    bool finish() {
+        header.indexOffset = position;
+        size_t indexSize = index.size() * sizeof(TileIndexEntry);
+        failed = failed || fwrite(index.data(), 1, indexSize, out) != indexSize;
+        failed = failed || fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1;
+        return !failed;
+    }
+
+    uint64_t getSize() const { return position; }
+    int getTilesWritten() const { return tilesWritten; }
+
+private:
+
+    FILE* out;
+    TileStoreHeader header;
+    std::vector<TileIndexEntry> index;
+    uint64_t position;
+    int tilesWritten;
+    bool failed;
+    jpeg_compress_struct compressor;
+    jpeg_error_mgr errorManager;
+};
+
+// one level of the pyramid, fed a row at a time from the top
+class LevelBuilder {
+
+public:
+
+    LevelBuilder(int level, int width, int height, int tilesX, int tilesY, TileWriter& writer, LevelBuilder* next) :
+        level(level), width(width), height(height), tilesX(tilesX), tilesY(tilesY), writer(writer), next(next),
+        rows((size_t) RING_ROWS * width * 4), tile((size_t) PAGE_SIZE * PAGE_SIZE * 3), nextTileRow(0) {}
+
+    // where row y must be written before calling addRow(y)
+    unsigned char* row(int y) {
+        return rows.data() + (size_t) (y % RING_ROWS) * width * 4;
+    }
+
+    void addRow(int y) {
+        // the rows of the tiles whose last row this is are all in the ring
+        while (nextTileRow < tilesY && nextTileRow * TILE_SIZE < height
+                && std::min(nextTileRow * TILE_SIZE + TILE_SIZE + TILE_BORDER - 1, height - 1) <= y) {
+            writeTileRow(nextTileRow);
+            nextTileRow++;
+        }
+        if (next == nullptr) {
+            return;
+        }
+        // RING_ROWS is even, so two rows that are averaged are contiguous
+        if (height == 1) {
+            downsampleRGBA(row(y), width, 1, next->row(0));
+            next->addRow(0);
+        } else if (y % 2 == 1 && y / 2 < next->height) {
+            downsampleRGBA(row(y - 1), width, 2, next->row(y / 2));
+            next->addRow(y / 2);
+        }
+    }
+
+private:
+
+    static const int RING_ROWS = TILE_SIZE + 2 * TILE_BORDER;
+
+    int level;
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    TileWriter& writer;
+    LevelBuilder* next;
+    std::vector<unsigned char> rows;
+    std::vector<unsigned char> tile;
+    int nextTileRow;
+
+    void writeTileRow(int tileY) {
+        for (int tileX = 0; tileX < tilesX && tileX * TILE_SIZE < width; tileX++) {
+            unsigned char* out = tile.data();
+            for (int y = 0; y < PAGE_SIZE; y++) {
+                int sourceY = std::max(0, std::min(tileY * TILE_SIZE - TILE_BORDER + y, height - 1));
+                const unsigned char* source = row(sourceY);
+                for (int x = 0; x < PAGE_SIZE; x++) {
+                    int sourceX = ((tileX * TILE_SIZE - TILE_BORDER + x) % width + width) % width;
+                    memcpy(out, source + sourceX * 4, 3);
+                    out += 3;
+                }
+            }
+            writer.write(level, tileX, tileY, tile.data());
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+
+    if (argc != 3) {
+        printf("usage: %s image output.tiles\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Could not open %s\n", argv[1]);
+        return 1;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    ImageDecoder decoder;
+    if (mapping == MAP_FAILED || !decoder.open((const unsigned char*) mapping, st.st_size) || !decoder.canStream()) {
+        printf("Could not decode %s\n", argv[1]);
+        return 1;
+    }
+
+    TileStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILE_STORE_MAGIC, sizeof(header.magic));
+    header.imageWidth = decoder.getWidth();
+    header.imageHeight = decoder.getHeight();
+    header.tileSize = TILE_SIZE;
+    header.border = TILE_BORDER;
+    header.tilesX = nextPowerOfTwo((decoder.getWidth() + TILE_SIZE - 1) / TILE_SIZE);
+    header.tilesY = nextPowerOfTwo((decoder.getHeight() + TILE_SIZE - 1) / TILE_SIZE);
+    // down to a single tile
+    header.levels = floorLog2(std::max(header.tilesX, header.tilesY)) + 1;
+
+    FILE* out = fopen(argv[2], "wb");
+    if (out == nullptr) {
+        printf("Could not open %s for writing\n", argv[2]);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    TileWriter writer(out, header);
+
+    // the coarsest level first, so that each level can point at the next one
+    std::vector<std::unique_ptr<LevelBuilder> > builders(header.levels);
+    for (int level = header.levels - 1; level >= 0; level--) {
+        int width = std::max(1, decoder.getWidth() >> level);
+        int height = std::max(1, decoder.getHeight() >> level);
+        LevelBuilder* next = level + 1 < (int) header.levels ? builders[level + 1].get() : nullptr;
+        builders[level].reset(new LevelBuilder(level, width, height, levelTiles(header.tilesX, level),
+            levelTiles(header.tilesY, level), writer, next));
+    }
+
+    bool decoded = decoder.startRows(4);
+    for (int y = 0; decoded && y < decoder.getHeight(); y++) {
+        decoded = decoder.readRows(builders[0]->row(y), 1, false);
+        builders[0]->addRow(y);
+    }
+    decoded = decoder.finishRows() && decoded;
+    munmap(mapping, st.st_size);
+
+    bool written = writer.finish();
+    written = fclose(out) == 0 && written;
+    if (!decoded || !written) {
+        printf("Could not write %s\n", argv[2]);
+        remove(argv[2]);
+        return 1;
+    }
+    printf("%s: %d x %d, %u levels of %d x %d tiles, %d tiles, %.1f MB\n", argv[2], header.imageWidth, header.imageHeight,
+        header.levels, header.tilesX, header.tilesY, writer.getTilesWritten(), writer.getSize() / 1048576.0);
+    return 0;
+}
@@ -0,0 +1,130 @@
+#ifndef TILESTORE_H
+#define TILESTORE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+ * The file format of virtual textures: an image cut into a pyramid of tiles,
+ * one level per power of two reduction, each tile compressed on its own as a
+ * JPEG file so that it can be read and decoded alone. Each tile carries a
+ * border of texels copied from its neighbours, so that bilinear filtering
+ * inside a tile never needs the tiles around it.
+ *
+ * The tiler tool writes tile stores, virtualtexture.h reads them.
+ */
+
+const char TILE_STORE_MAGIC[8] = { 'C', 'G', 'L', 'T', 'I', 'L', 'E', '1' };
+
+struct TileStoreHeader {
+    char magic[8];
+    uint32_t imageWidth;
+    uint32_t imageHeight;
+    // texels of the image covered by a tile side; stored tiles are
+    // tileSize + 2 * border texels wide
+    uint32_t tileSize;
+    uint32_t border;
+    // the tiles of level 0, rounded up to powers of two so that the tile
+    // grids of the levels halve exactly like the mip levels of a texture
+    uint32_t tilesX;
+    uint32_t tilesY;
+    uint32_t levels;
+    uint32_t reserved;
+    // the index lists every tile of every level, finest level first, row by row
+    uint64_t indexOffset;
+};
+
+struct TileIndexEntry {
+    uint64_t offset;
+    // 0 for the tiles beyond the edges of the image
+    uint32_t size;
+    uint32_t reserved;
+};
+
+inline int levelTiles(uint32_t tiles, int level) {
+    return std::max(1, (int) (tiles >> level));
+}
+
+// the number of tiles of all the levels before the given one
+inline size_t tileIndexBase(const TileStoreHeader& header, int level) {
+    size_t base = 0;
+    for (int l = 0; l < level; l++) {
+        base += (size_t) levelTiles(header.tilesX, l) * levelTiles(header.tilesY, l);
+    }
+    return base;
+}
+
+// read access to a tile store; readTile may be called from any thread
+class TileStore {
+
+public:
+
+    TileStore() : fd(-1) {}
+
+    ~TileStore() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            printf("Could not open tile store %s\n", path.c_str());
+            return false;
+        }
+        size_t tileCount = 0;
+        if (pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+                && memcmp(header.magic, TILE_STORE_MAGIC, sizeof(header.magic)) == 0
+                && header.levels > 0 && header.levels <= 32) {
+            tileCount = tileIndexBase(header, header.levels);
+            index.resize(tileCount);
+        }
+        size_t indexSize = tileCount * sizeof(TileIndexEntry);
+        if (tileCount == 0 || pread(fd, index.data(), indexSize, header.indexOffset) != (ssize_t) indexSize) {
+            printf("%s is not a tile store\n", path.c_str());
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    const TileStoreHeader& getHeader() const { return header; }
+    int getLevels() const { return header.levels; }
+    int getTilesX(int level) const { return levelTiles(header.tilesX, level); }
+    int getTilesY(int level) const { return levelTiles(header.tilesY, level); }
+    int getPageSize() const { return header.tileSize + 2 * header.border; }
+
+    bool hasTile(int level, int x, int y) const {
+        return entry(level, x, y).size > 0;
+    }
+
+    // reads the encoded bytes of a tile
+    bool readTile(int level, int x, int y, std::vector<unsigned char>& data) const {
+        const TileIndexEntry& e = entry(level, x, y);
+        data.resize(e.size);
+        return e.size > 0 && pread(fd, data.data(), e.size, e.offset) == (ssize_t) e.size;
+    }
+
+private:
+
+    int fd;
+    TileStoreHeader header;
+    std::vector<TileIndexEntry> index;
+
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+
+    const TileIndexEntry& entry(int level, int x, int y) const {
+        return index[tileIndexBase(header, level) + (size_t) y * getTilesX(level) + x];
+    }
+};
+
+#endif
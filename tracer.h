@@ -0,0 +1,258 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+/*
+ * Timeline of the CPU work of every thread, written in the trace event format
+ * that chrome://tracing and ui.perfetto.dev open:
+ *
+ *     CGLCORE_TRACE=trace.json ./tutorial09
+ *
+ * A scope records its name, when it began and how long it lasted:
+ *
+ *     void createProgram() {
+ *         Tracer::Scope trace("createProgram");
+ *         ...
+ *     }
+ *
+ * and scopes nest. Each thread writes its scopes into a ring of its own,
+ * without a lock, so the workers do not contend over the tracer; the ring is
+ * allocated and registered, under the only lock, the first time the thread
+ * records, and once full it overwrites its oldest scopes. A dump reads the
+ * rings while their threads go on writing them, and drops the scopes it may
+ * have read half overwritten. When tracing is off a scope costs a couple of
+ * loads and a branch.
+ *
+ * finish() writes the rings of all the threads, those that have exited
+ * included, as complete ("X") events in microseconds since start().
+ */
+
+class Tracer {
+
+public:
+
+    // the tracer of the process, which all the threads share
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // traces until finish(), which writes dumpPath; each thread keeps its
+    // last capacity scopes, rounded up to a power of 2. The calling thread
+    // is named main. A process traces once
+    bool start(const std::string& dumpPath, int capacity = 1 << 16) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (started) {
+                return false;
+            }
+            started = true;
+            this->dumpPath = dumpPath;
+            ringSize = 1;
+            while (ringSize < (size_t) capacity) {
+                ringSize *= 2;
+            }
+            origin = now();
+        }
+        enabled.store(true, std::memory_order_release);
+        setThreadName("main");
+        return true;
+    }
+
+    // CGLCORE_TRACE is the path of the trace
+    bool startFromEnvironment() {
+        const char* value = getenv("CGLCORE_TRACE");
+        if (value == nullptr || *value == 0) {
+            return false;
+        }
+        return start(value);
+    }
+
+    bool tracing() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // names the calling thread in the trace, "thread <n>" otherwise
+    void setThreadName(const std::string& name) {
+        if (!tracing()) {
+            return;
+        }
+        ThreadRing* ring = threadRing();
+        std::lock_guard<std::mutex> lock(mutex);
+        ring->name = name;
+    }
+
+    // name must outlive the tracer, a string literal typically; begin and
+    // end come from now()
+    void record(const char* name, int64_t begin, int64_t end) {
+        ThreadRing* ring = threadRing();
+        uint64_t index = ring->written.load(std::memory_order_relaxed);
+        Slot& slot = ring->slots[index & (ring->slots.size() - 1)];
+        // a dump() that reads what follows also sees written at index, and
+        // hence that the slot is being overwritten
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.begin.store(begin, std::memory_order_relaxed);
+        slot.end.store(end, std::memory_order_relaxed);
+        // publishes the event to dump()
+        ring->written.store(index + 1, std::memory_order_release);
+    }
+
+    // the clock of the scopes, in nanoseconds
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // records the time from its construction to its destruction
+    class Scope {
+
+    public:
+
+        explicit Scope(const char* name) : name(instance().tracing() ? name : nullptr), begin(0) {
+            if (this->name != nullptr) {
+                begin = now();
+            }
+        }
+
+        ~Scope() {
+            if (name != nullptr) {
+                instance().record(name, begin, now());
+            }
+        }
+
+    private:
+
+        const char* name;
+        int64_t begin;
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // writes the scopes recorded so far as a trace; the threads may go on
+    // recording meanwhile
+    bool dump(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            printf("Cannot write %s\n", path.c_str());
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        int pid = (int) getpid();
+        long written = 0;
+        long dropped = 0;
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        for (size_t i = 0; i < rings.size(); i++) {
+            ThreadRing& ring = *rings[i];
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                i == 0 ? "" : ",", pid, ring.id, ring.name.c_str());
+            uint64_t size = ring.slots.size();
+            uint64_t end = ring.written.load(std::memory_order_acquire);
+            uint64_t first = end > size ? end - size : 0;
+            std::vector<Event> events;
+            events.reserve(end - first);
+            for (uint64_t index = first; index < end; index++) {
+                const Slot& slot = ring.slots[index & (size - 1)];
+                Event event = { slot.name.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed),
+                    slot.end.load(std::memory_order_relaxed) };
+                events.push_back(event);
+            }
+            // the owner may have come around the ring while it was copied:
+            // the events it overwrote, and the one it may be overwriting, are
+            // not to be trusted
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = ring.written.load(std::memory_order_relaxed);
+            uint64_t valid = after + 1 > size ? after + 1 - size : 0;
+            for (uint64_t index = std::max(first, valid); index < end; index++) {
+                const Event& event = events[index - first];
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, pid, ring.id, (event.begin - origin) / 1e3, (event.end - event.begin) / 1e3);
+                written++;
+            }
+            dropped += std::min(std::max(first, valid), end);
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        if (dropped > 0) {
+            printf("%s: %ld scopes dropped from full rings\n", path.c_str(), dropped);
+        }
+        printf("%s: %ld scopes of %d threads written\n", path.c_str(), written, (int) rings.size());
+        return true;
+    }
+
+    // stops tracing and writes the trace
+    void finish() {
+        if (!tracing()) {
+            return;
+        }
+        enabled.store(false, std::memory_order_release);
+        dump(dumpPath);
+    }
+
+private:
+
+    struct Event {
+        const char* name;
+        int64_t begin;
+        int64_t end;
+    };
+
+    // an event in a ring, which dump() may read while its thread rewrites it
+    struct Slot {
+        Slot() : name(nullptr), begin(0), end(0) {}
+        std::atomic<const char*> name;
+        std::atomic<int64_t> begin;
+        std::atomic<int64_t> end;
+    };
+
+    // written by its thread only, read by dump()
+    struct ThreadRing {
+        ThreadRing(int id, size_t size) : id(id), slots(size), written(0) {
+            char text[32];
+            snprintf(text, sizeof(text), "thread %d", id);
+            name = text;
+        }
+        int id;
+        std::string name;
+        std::vector<Slot> slots;
+        std::atomic<uint64_t> written;
+    };
+
+    std::atomic<bool> enabled;
+    bool started;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadRing> > rings;
+    size_t ringSize;
+    std::string dumpPath;
+    int64_t origin;
+
+    Tracer() : enabled(false), started(false), ringSize(1), origin(0) {}
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // the ring of the calling thread, registered on first use; the tracer
+    // owns it, so that it outlives the thread
+    ThreadRing* threadRing() {
+        static thread_local ThreadRing* ring = nullptr;
+        if (ring == nullptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(std::unique_ptr<ThreadRing>(new ThreadRing((int) rings.size() + 1, ringSize)));
+            ring = rings.back().get();
+        }
+        return ring;
+    }
+};
+
+#endif
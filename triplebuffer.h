@@ -0,0 +1,74 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/*
+ * Hands values from one writer thread to one reader thread without either
+ * ever waiting for the other. Of the three slots, the writer fills its back
+ * slot, the reader reads its front slot, and the third one sits in the
+ * middle; publishing swaps the back slot with the middle one and marks it
+ * fresh, acquiring swaps the front slot with the middle one if it is fresh:
+ *
+ *     packets.back().elapsed = elapsed;    // on the writer
+ *     packets.publish();
+ *
+ *     packets.acquire();                   // on the reader
+ *     draw(packets.front());
+ *
+ * The reader thus always has the latest value published, and keeps its
+ * current one when nothing new was published; the values the reader did not
+ * get to in time are skipped. A slot is only ever touched by one side at a
+ * time, and keeps its allocations from one use to the next.
+ */
+
+template <class T>
+class TripleBuffer {
+
+public:
+
+    TripleBuffer() : middle(1), backIndex(2), frontIndex(0) {}
+
+    // the slot the writer fills, no longer seen by the reader
+    T& back() {
+        return slots[backIndex];
+    }
+
+    // makes the back slot the latest value, and takes an older one to fill next
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // takes the latest value into the front slot, returns false and keeps the
+    // current one when none was published since the last acquire
+    bool acquire() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    // the slot the reader reads, which the writer leaves alone
+    const T& front() const {
+        return slots[frontIndex];
+    }
+
+private:
+
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T slots[3];
+    // the index of the middle slot, with FRESH when it is newer than the front
+    std::atomic<int> middle;
+    // owned by the writer
+    int backIndex;
+    // owned by the reader
+    int frontIndex;
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+};
+
+#endif
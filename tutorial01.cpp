@@ -6,6 +6,11 @@
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <GL/glx.h>
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "ondemand.h"
 
 /*
  * In this tutorial, we render triangles without specifying a shader program.
@@ -20,10 +25,16 @@
 const int POSITION_ATTRIBUTE_INDEX = 0;
 
 bool initialized; // have we initialized the buffer objects?
+Headless headless; // renders without a window with -headless, see headless.h
+FrameLoop frameLoop; // paces the frames at -fps N, 60 by default, see frameloop.h
+FramesInFlight framesInFlight; // bounds the frames queued for the GPU to -inflight N, see inflight.h
+bool onDemand; // only redraws when the window needs it with -ondemand, see ondemand.h
+RedrawSignal redraw; // set by the events that need a redraw
 GLuint trianglesId; // the triangles VBO id
 
 // create the triangle vertex buffer
 void createTriangles() {
+    Tracer::Scope trace("createTriangles");
     float positions[3*3*9];
     for (int i = 0; i < 3; i++) {
         for (int j = 0; j < 3; j++) {
@@ -56,9 +67,27 @@ void reshape(int width, int height) {
     glViewport(0, 0, width, height);
 }
 
+// releases the GL objects, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    glDeleteBuffers(1, &trianglesId);
+    trianglesId = 0;
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    releaseScene();
+    framesInFlight.finish();
+    Tracer::instance().finish();
+}
+
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         createTriangles();
         initialized = true;
     }
@@ -115,6 +144,27 @@ int ctxErrorHandler(Display* display, XErrorEvent* event) {
 // http://www.opengl.org/wiki/Tutorial%3a_OpenGL_3.0_Context_Creation_%28GLX%29
 int main (int argc, char** argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-ondemand") == 0) {
+            onDemand = true;
+        }
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        // the loop below swaps after render(), here it is up to the runner
+        headless.run([] { render(); Tracer::Scope trace("swap"); headless.swap(); framesInFlight.throttle(); }, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     Display* display = XOpenDisplay(nullptr);
     if (display == nullptr) {
         printf("Failed to open X display\n");
@@ -169,7 +219,7 @@ int main (int argc, char** argv) {
     swa.colormap = cmap = XCreateColormap(display, RootWindow(display, vi->screen), vi->visual, AllocNone);
     swa.background_pixmap = None;
     swa.border_pixel = 0;
-    swa.event_mask = StructureNotifyMask | KeyPressMask;
+    swa.event_mask = StructureNotifyMask | ExposureMask | KeyPressMask;
     Window win = XCreateWindow(display, RootWindow(display, vi->screen), 0, 0, 800, 600,
         0, vi->depth, InputOutput, vi->visual, CWBorderPixel|CWColormap|CWEventMask, &swa);
     if (!win) {
@@ -222,6 +272,7 @@ int main (int argc, char** argv) {
 
     reshape(800, 600);
 
+    frameLoop.start(ConnectionNumber(display));
     bool done = false;
     while (!done) {
         while (XPending(display) > 0) {
@@ -229,19 +280,35 @@ int main (int argc, char** argv) {
             XNextEvent(display, &event);
             switch (event.type) {
             case Expose:
+                redraw.invalidate();
                 break;
             case ConfigureNotify:
                 reshape(event.xconfigure.width, event.xconfigure.height);
+                redraw.invalidate();
                 break;
             case KeyPress:
                 done = true;
                 break;
             }
         }
+        if (onDemand && !redraw.take()) {
+            // nothing changed, sleeps until the server or an invalidate() has news
+            if (!done) {
+                redraw.wait(ConnectionNumber(display));
+            }
+            continue;
+        }
+        if (!onDemand && !frameLoop.wait()) {
+            // the server sent events, which go before the frame
+            continue;
+        }
         render();
+        Tracer::Scope trace("swap");
         glXSwapBuffers(display, win);
+        framesInFlight.throttle();
     }
 
+    destroy();
     glXDestroyContext(display, ctx);
     XDestroyWindow(display, win);
     XFreeColormap(display, cmap);
@@ -7,6 +7,11 @@
 #include <GL/glew.h>
 #include <GL/gl.h>
 #include <GL/glx.h>
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "ondemand.h"
 
 //
 // In this tutorial, we render a triangle and a quad using a shader program
@@ -18,6 +23,16 @@
 const int POSITION_ATTRIBUTE_INDEX = 0;
 
 bool initialized = false;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// only redraws when the window needs it with -ondemand, see ondemand.h
+bool onDemand = false;
+// set by the events that need a redraw
+RedrawSignal redraw;
 GLuint trianglesId;
 GLuint quadId;
 GLuint programId;
@@ -56,6 +71,7 @@ void checkShaderCompileStatus(GLuint shaderId) {
         glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
         log[infoLogLength] = 0;
         printf("%s", log);
+        free(log);
     }
 }
 
@@ -70,10 +86,12 @@ void checkProgramLinkStatus(GLuint programId) {
         glGetProgramInfoLog(programId, infoLogLength, NULL, log);
         log[infoLogLength] = 0;
         printf("%s", log);
+        free(log);
     }
 }
 
 void createProgram() {
+    Tracer::Scope trace("createProgram");
 
 	//
 	// compile the vertex shader
@@ -104,9 +122,17 @@ void createProgram() {
     glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "inPosition");
     glLinkProgram(programId);
     checkProgramLinkStatus(programId);
+
+    // the linked program does not need the shaders anymore, they are actually
+    // deleted once detached
+    glDetachShader(programId, vertexShaderId);
+    glDetachShader(programId, fragmentShaderId);
+    glDeleteShader(vertexShaderId);
+    glDeleteShader(fragmentShaderId);
 }
 
 void createTriangle() {
+    Tracer::Scope trace("createTriangle");
     float positions[] = {
             0.0f, 0.0f, 0.0f,
             1.0f, 0.0f, 0.0f,
@@ -118,6 +144,7 @@ void createTriangle() {
 }
 
 void createQuad() {
+    Tracer::Scope trace("createQuad");
     float positions[] = {
             0.0f, 0.0f, 0.0f,
             -1.0f, 0.0f, 0.0f,
@@ -151,9 +178,31 @@ void reshape(int width, int height) {
     glViewport(0, 0, width, height);
 }
 
+// releases the GL objects, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    glDeleteProgram(programId);
+    glDeleteBuffers(1, &trianglesId);
+    glDeleteBuffers(1, &quadId);
+    programId = 0;
+    trianglesId = 0;
+    quadId = 0;
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    releaseScene();
+    framesInFlight.finish();
+    Tracer::instance().finish();
+}
+
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         createProgram();
         createTriangle();
         createQuad();
@@ -214,6 +263,27 @@ int ctxErrorHandler(Display* display, XErrorEvent* event) {
 // http://www.opengl.org/wiki/Tutorial%3a_OpenGL_3.0_Context_Creation_%28GLX%29
 int main (int argc, char** argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-ondemand") == 0) {
+            onDemand = true;
+        }
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        // the loop below swaps after render(), here it is up to the runner
+        headless.run([] { render(); Tracer::Scope trace("swap"); headless.swap(); framesInFlight.throttle(); }, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     Display* display = XOpenDisplay(nullptr);
     if (display == nullptr) {
         printf("Failed to open X display\n");
@@ -268,7 +338,7 @@ int main (int argc, char** argv) {
     swa.colormap = cmap = XCreateColormap(display, RootWindow(display, vi->screen), vi->visual, AllocNone);
     swa.background_pixmap = None;
     swa.border_pixel = 0;
-    swa.event_mask = StructureNotifyMask | KeyPressMask;
+    swa.event_mask = StructureNotifyMask | ExposureMask | KeyPressMask;
     Window win = XCreateWindow(display, RootWindow(display, vi->screen), 0, 0, 800, 600,
         0, vi->depth, InputOutput, vi->visual, CWBorderPixel|CWColormap|CWEventMask, &swa);
     if (!win) {
@@ -321,6 +391,7 @@ int main (int argc, char** argv) {
 
     reshape(800, 600);
 
+    frameLoop.start(ConnectionNumber(display));
     bool done = false;
     while (!done) {
         while (XPending(display) > 0) {
@@ -328,19 +399,35 @@ int main (int argc, char** argv) {
             XNextEvent(display, &event);
             switch (event.type) {
             case Expose:
+                redraw.invalidate();
                 break;
             case ConfigureNotify:
                 reshape(event.xconfigure.width, event.xconfigure.height);
+                redraw.invalidate();
                 break;
             case KeyPress:
                 done = true;
                 break;
             }
         }
+        if (onDemand && !redraw.take()) {
+            // nothing changed, sleeps until the server or an invalidate() has news
+            if (!done) {
+                redraw.wait(ConnectionNumber(display));
+            }
+            continue;
+        }
+        if (!onDemand && !frameLoop.wait()) {
+            // the server sent events, which go before the frame
+            continue;
+        }
         render();
+        Tracer::Scope trace("swap");
         glXSwapBuffers(display, win);
+        framesInFlight.throttle();
     }
 
+    destroy();
     glXDestroyContext(display, ctx);
     XDestroyWindow(display, win);
     XFreeColormap(display, cmap);
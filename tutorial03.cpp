@@ -1,9 +1,16 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <SDL/SDL.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "capture.h"
 
 /*
  * In this tutorial, we render a triangle and a quad that overlap. It uses some
@@ -26,9 +33,17 @@ const float nearPlane = 1.0f;
 const float farPlane = -1.0f;
 
 bool initialized = false;
-GLuint trianglesId;
-GLuint quadId;
-GLuint programId;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+gl::Buffer triangles;
+gl::Buffer quad;
+gl::Program program;
 float aspectRatio;
 
 void ortho(matrix44 m, float left, float right, float bottom, float top, float near, float far) {
@@ -50,83 +65,35 @@ void ortho(matrix44 m, float left, float right, float bottom, float top, float n
     m[15] = 1.0f;
 }
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
+void createProgram() {
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial03.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
 
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
+    AssetData fragmentShaderSource("tutorial03.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
 
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial03.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial03.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
     // associates the "inPosition" variable from the vertex shader with the position attribute
     // the variable and the attribute must be bound before the program is linked
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "position");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "position");
+    program.link();
 }
 
 void createTriangle() {
+    Tracer::Scope trace("createTriangle");
     float positions[] = {
             -0.5f, -0.5f, 0.0f,
             1.0f, -0.5f, 0.0f,
             -0.5f, 1.0f, 0.0f
     };
-    glGenBuffers(1, &trianglesId);
-    glBindBuffer(GL_ARRAY_BUFFER, trianglesId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    triangles = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(positions), positions);
 }
 
 void createQuad() {
+    Tracer::Scope trace("createQuad");
     float positions[] = {
             0.5f, 0.5f, 0.0f,
             -1.0f, 0.5f, 0.0f,
@@ -135,14 +102,12 @@ void createQuad() {
             -1.0f, -1.0f, 0.0f,
             -1.0f, 0.5f, 0.0f
     };
-    glGenBuffers(1, &quadId);
-    glBindBuffer(GL_ARRAY_BUFFER, quadId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    quad = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(positions), positions);
 }
 
 void renderTriangle() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, trianglesId);
+    glBindBuffer(GL_ARRAY_BUFFER, triangles.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, 3);
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -150,7 +115,7 @@ void renderTriangle() {
 
 void renderQuad() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, quadId);
+    glBindBuffer(GL_ARRAY_BUFFER, quad.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -163,8 +128,10 @@ void reshape(int width, int height) {
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         createProgram();
         createTriangle();
         createQuad();
@@ -174,17 +141,17 @@ void render() {
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     glClear(GL_COLOR_BUFFER_BIT);
-    glUseProgram(programId);
+    program.use();
 
     // defines the model view projection matrix and set the corresponding uniform
     // NB: bottom and top are adjusted with the aspect ratio
     matrix44 mvp;
     ortho(mvp, left, right, bottom / aspectRatio, top / aspectRatio, nearPlane, farPlane);
-    GLuint matrixUniform = glGetUniformLocation(programId, "mvpMatrix");
+    GLuint matrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
     glUniformMatrix4fv(matrixUniform, 1, false, mvp);
 
 	// we need the location of the uniform in order to set its value
-    GLuint color = glGetUniformLocation(programId, "color");
+    GLuint color = glGetUniformLocation(program.getId(), "color");
 
 	// render the triangle in yellow
     glUniform4f(color, 1.0f, 1.0f, 0.0f, 0.7f);
@@ -194,11 +161,54 @@ void render() {
     glUniform4f(color, 0.2f, 0.2f, 1.0f, 0.7f);
     renderQuad();
 
-    SDL_GL_SwapBuffers();
+    capture.capture();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    triangles.reset();
+    quad.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    releaseScene();
+    framesInFlight.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     if(SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         printf("SDL could not initialize.");
         return 1;
@@ -223,7 +233,9 @@ int main(int argc, char **argv) {
 
     glewInit(); // must be called AFTER the OpenGL context has been created
     reshape(800, 600);
+    capture.startFromEnvironment(800, 600);
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -232,9 +244,12 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
@@ -1,12 +1,21 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include <SDL/SDL.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
 #include <GL/glxew.h>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "capture.h"
 
 /*
  * In this tutorial, we render a rotating cube, with some diffuse lighting.
@@ -15,7 +24,6 @@
 
 typedef float matrix44[16];
 
-inline long currentTimeMillis() { return clock() / (CLOCKS_PER_SEC / 1000); }
 const float pi = atan(1.0f) * 4.0f;
 inline float toRadians(float degrees) { return degrees * pi / 180.0f; }
 
@@ -32,13 +40,24 @@ const float nearPlane = 1.0f;
 const float farPlane = 10.0f;
 
 bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint cubePositionsId;
-GLuint cubeNormalsId;
-GLuint programId;
+gl::Buffer cubePositions;
+gl::Buffer cubeNormals;
+gl::Program program;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
@@ -132,71 +151,24 @@ void setSwapInterval(int interval) {
     }
 }
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial04.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial04.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "vNormal");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial04.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource("tutorial04.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "vNormal");
+    program.link();
 }
 
 void createCube() {
+    Tracer::Scope trace("createCube");
     float positions[] = {
         // back face
         1.0f, 1.0f, -1.0f,
@@ -241,9 +213,7 @@ void createCube() {
         1.0f, 1.0f, -1.0f,
         1.0f, 1.0f, 1.0f
     };
-    glGenBuffers(1, &cubePositionsId);
-    glBindBuffer(GL_ARRAY_BUFFER, cubePositionsId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    cubePositions = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(positions), positions);
     float normals[] = {
         // back face
         0.0f, 0.0f, -1.0f,
@@ -288,17 +258,15 @@ void createCube() {
         1.0f, 0.0f, 0.0f,
         1.0f, 0.0f, 0.0f
     };
-    glGenBuffers(1, &cubeNormalsId);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeNormalsId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(normals), normals, GL_STATIC_DRAW);
+    cubeNormals = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(normals), normals);
 }
 
 void renderCube() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, cubePositionsId);
+    glBindBuffer(GL_ARRAY_BUFFER, cubePositions.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeNormalsId);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeNormals.getId());
     glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -317,25 +285,27 @@ void reshape(int width, int height) {
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial04: %d FPS @ %d x %d", frameCount * 4, currentWidth, currentHeight);
+    sprintf(title, "Tutorial04: %.0f FPS (%s) @ %d x %d",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight);
     SDL_WM_SetCaption(title, title);
-    frameCount = 0;
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         createProgram();
         createCube();
         setSwapInterval(0);
-        startTimeMillis = currentTimeMillis();
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    frameClock.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 250) {
         timer(0);
@@ -344,7 +314,7 @@ void render() {
 
     glClear(GL_COLOR_BUFFER_BIT);
     glEnable(GL_CULL_FACE);
-    glUseProgram(programId);
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -359,10 +329,10 @@ void render() {
     multm(mvp, frustumMat, mv);
 
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint colorUniform = glGetUniformLocation(programId, "color");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint colorUniform = glGetUniformLocation(program.getId(), "color");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp);
     glUniformMatrix4fv(mvMatrixUniform, 1, false, mv);
     glUniform3f(colorUniform, 0.0f, 1.0f, 0.0f);
@@ -371,12 +341,63 @@ void render() {
 	// render the cube
     renderCube();
 
+    capture.capture();
     // display rendering buffer
-    SDL_GL_SwapBuffers();
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    cubePositions.reset();
+    cubeNormals.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     if(SDL_Init(SDL_INIT_EVERYTHING) < 0) {
         printf("SDL could not initialize.");
         return 1;
@@ -401,7 +422,9 @@ int main(int argc, char **argv) {
 
     glewInit(); // must be called AFTER the OpenGL context has been created
     reshape(800, 600);
+    capture.startFromEnvironment(800, 600);
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -410,9 +433,16 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
@@ -1,14 +1,23 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
-#include <png.h>
+#include <algorithm>
 #include <GL/glew.h>
+#include <X11/Xlib.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtkgl.h>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "renderthread.h"
+#include "gpuprofiler.h"
+#include "image.h"
 
 /*
  * In this tutorial, we render a rotating cube with a transparent texture.
@@ -17,7 +26,6 @@
 
 typedef float matrix44[16];
 
-inline long currentTimeMillis() { return clock() / (CLOCKS_PER_SEC / 1000); }
 const float pi = atan(1.0f) * 4.0f;
 inline float toRadians(float degrees) { return degrees * pi / 180.0f; }
 
@@ -26,6 +34,9 @@ const int POSITION_ATTRIBUTE_INDEX = 0;
 const int NORMAL_ATTRIBUTE_INDEX = 1;
 const int TEXCOORD_ATTRIBUTE_INDEX = 2;
 
+// the number of image rows decoded and uploaded at a time
+const int TEXTURE_BAND_ROWS = 64;
+
 // defines the perspective projection volume
 const float left = -1.0f;
 const float right = 1.0f;
@@ -35,103 +46,32 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 GtkWidget *window;
-guint idle_id = 0;
+GdkGLContext* glcontext;
+GdkGLDrawable* gldrawable;
+// renders the frames while the main loop dispatches the events, see renderthread.h
+RenderThread renderThread;
 
 bool initialized = false;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-GLuint textureId;
-GLuint cubePositionsId;
-GLuint cubeNormalsId;
-GLuint cubeTexCoordsId;
+gl::Program program;
+gl::Texture texture;
+gl::Buffer cubePositions;
+gl::Buffer cubeNormals;
+gl::Buffer cubeTexCoords;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
+// times the passes when CGLCORE_GPU_PROFILE is set, see gpuprofiler.h
+GpuProfiler gpuProfiler;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-char* readPngFile(const char* filename, int *width, int *height, GLenum *format) {
-    FILE *fp;
-    png_structp png_ptr;
-    png_infop info_ptr;
-    fp = fopen(filename, "rb");
-
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    info_ptr = png_create_info_struct(png_ptr);
-
-    png_init_io(png_ptr, fp);
-    png_read_info(png_ptr, info_ptr);
-
-    if (info_ptr->color_type == PNG_COLOR_TYPE_RGB) {
-        *format = GL_RGB;
-    } else if (info_ptr->color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
-        *format = GL_RGBA;
-    } else {
-        printf("Unsupported color type in readPngFile(%s)", filename);
-        return NULL;
-    }
-
-    *width = info_ptr->width;
-    *height = info_ptr->height;
-
-    int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
-    png_bytep image_data = (png_bytep) malloc(rowbytes * info_ptr->height);
-    png_bytepp row_pointers = (png_bytepp) malloc(info_ptr->height * sizeof(png_bytep));
-
-    for (unsigned int i = 0; i < info_ptr->height; ++i) {
-      row_pointers[info_ptr->height - 1 - i] = image_data + i * rowbytes;
-    }
-
-    png_read_image(png_ptr, row_pointers);
-    //png_read_destroy(png_ptr, info_ptr, (png_infop)0);
-    free(png_ptr);
-    free(info_ptr);
-    free(row_pointers);
-    fclose(fp);
-    return (char*) image_data;
-}
-
 void frustum(matrix44 m, float left, float right, float bottom, float top, float near, float far) {
     m[0] = 2 * near / (right - left);
     m[1] = 0.0f;
@@ -204,6 +144,7 @@ void multm(matrix44 m, matrix44 m1, matrix44 m2) {
 }
 
 void createCube() {
+    Tracer::Scope trace("createCube");
     float positions[] = {
         // back face
         1.0f, 1.0f, -1.0f,
@@ -248,9 +189,7 @@ void createCube() {
         1.0f, 1.0f, -1.0f,
         1.0f, 1.0f, 1.0f
     };
-    glGenBuffers(1, &cubePositionsId);
-    glBindBuffer(GL_ARRAY_BUFFER, cubePositionsId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    cubePositions = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(positions), positions);
     float normals[] = {
         // back face
         0.0f, 0.0f, -1.0f,
@@ -295,9 +234,7 @@ void createCube() {
         1.0f, 0.0f, 0.0f,
         1.0f, 0.0f, 0.0f
     };
-    glGenBuffers(1, &cubeNormalsId);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeNormalsId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(normals), normals, GL_STATIC_DRAW);
+    cubeNormals = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(normals), normals);
     float texcoords[] = {
         // back face
         1.0f, 1.0f,
@@ -342,58 +279,113 @@ void createCube() {
         1.0f, 0.0f,
         1.0f, 1.0f
     };
-    glGenBuffers(1, &cubeTexCoordsId);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeTexCoordsId);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);
+    cubeTexCoords = gl::Buffer::create(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords);
 }
 
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial05.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial05.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "pos");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "normal");
-    glBindAttribLocation(programId, TEXCOORD_ATTRIBUTE_INDEX, "texcoord");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial05.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource("tutorial05.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "pos");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "normal");
+    program.bindAttribLocation(TEXCOORD_ATTRIBUTE_INDEX, "texcoord");
+    program.link();
+}
+
+// decodes the image a band of rows at a time into two pixel buffers used in
+// turn: while GL copies one band into the texture, the decoder fills the
+// other, and the whole image never needs to be held in memory
+bool uploadInBands(ImageDecoder& decoder, GLenum format, int channels) {
+    Tracer::Scope trace("uploadInBands");
+    int width = decoder.getWidth();
+    int height = decoder.getHeight();
+    size_t bandSize = (size_t) width * channels * TEXTURE_BAND_ROWS;
+    gl::Buffer bands[2];
+    for (int i = 0; i < 2; i++) {
+        bands[i] = gl::Buffer::create(GL_PIXEL_UNPACK_BUFFER, bandSize, nullptr, GL_STREAM_DRAW);
+    }
+    bool decoded = decoder.startRows(channels);
+    for (int band = 0; decoded && decoder.getRowsRead() < height; band = 1 - band) {
+        int first = decoder.getRowsRead();
+        int count = std::min(TEXTURE_BAND_ROWS, height - first);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, bands[band].getId());
+        unsigned char* pixels = (unsigned char*) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bandSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        decoded = pixels != nullptr && decoder.readRows(pixels, count, true);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // the rows are flipped, so the top band of the image is the top of the texture
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, height - first - count, width, count, format, GL_UNSIGNED_BYTE, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return decoder.finishRows() && decoded;
+}
+
+// interlaced images only have their final rows once they are fully decoded
+bool uploadWhole(ImageDecoder& decoder, GLenum format, int channels) {
+    Tracer::Scope trace("uploadWhole");
+    int width = decoder.getWidth();
+    int height = decoder.getHeight();
+    unsigned char* data = (unsigned char*) malloc((size_t) width * height * channels);
+    bool decoded = decoder.decode(data, channels, true);
+    if (decoded) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+    }
+    // GL has its own copy of the pixels now
+    free(data);
+    return decoded;
 }
 
 void createTexture() {
-    int width, height;
-    GLenum format;
-    char* data = readPngFile("tux.png", &width, &height, &format);
-    glGenTextures(1, &textureId);
-    glBindTexture(GL_TEXTURE_2D, textureId);
+    Tracer::Scope trace("createTexture");
+    AssetData png("tux.png");
+    ImageDecoder decoder;
+    if (!decoder.open(png.data(), png.size())) {
+        printf("Could not read tux.png\n");
+        return;
+    }
+    int width = decoder.getWidth();
+    int height = decoder.getHeight();
+    int channels = decoder.getChannels();
+    GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+    // the cube is blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA, which expects
+    // premultiplied colors; filtering them also keeps the colors of the
+    // transparent texels from bleeding into the edges of the opaque ones
+    decoder.setPremultiplyAlpha(true);
+    texture = gl::Texture::create(GL_TEXTURE_2D);
+    texture.storage2D(gl::Texture::mipLevels(width, height), format == GL_RGBA ? GL_RGBA8 : GL_RGB8, width, height);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    // RGB rows are not necessarily a multiple of 4 bytes long
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // texture coordinates start at the bottom of the image, GL rows too
+    bool decoded = decoder.canStream() ? uploadInBands(decoder, format, channels) : uploadWhole(decoder, format, channels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (!decoded) {
+        printf("Could not decode tux.png\n");
+        texture.reset();
+        return;
+    }
+    glGenerateMipmap(GL_TEXTURE_2D);
 }
 
 void renderCube() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, cubePositionsId);
+    glBindBuffer(GL_ARRAY_BUFFER, cubePositions.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeNormalsId);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeNormals.getId());
     glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeTexCoordsId);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeTexCoords.getId());
     glVertexAttribPointer(TEXCOORD_ATTRIBUTE_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -402,37 +394,76 @@ void renderCube() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-gboolean reshape(GtkWidget* widget, GdkEventConfigure* event, gpointer data) {
-    int width = widget->allocation.width;
-    int height = widget->allocation.height;
+void reshape(int width, int height) {
     glViewport(0, 0, width, height);
     // we keep track of the aspect ratio to adjust the projection volume
     aspectRatio = 1.0f * width / height;
     currentWidth = width;
     currentHeight = height;
+}
+
+// the render thread owns the context and reshapes before its next frame
+gboolean configure(GtkWidget* widget, GdkEventConfigure* event, gpointer data) {
+    renderThread.postResize(widget->allocation.width, widget->allocation.height);
     return TRUE;
 }
 
+// GTK is only called from the main loop, the render thread posts the title
+gboolean setTitle(gpointer title) {
+    gtk_window_set_title(GTK_WINDOW(window), (const char*) title);
+    g_free(title);
+    return FALSE;
+}
+
+gboolean quit(gpointer data) {
+    gtk_main_quit();
+    return FALSE;
+}
+
+// the size of the window, on the render thread; while replaying, the sizes
+// come from the recording
+void resized(int width, int height) {
+    if (replay.replaying()) {
+        return;
+    }
+    replay.record(ReplayEvent::RESIZE, width, height);
+    reshape(width, height);
+}
+
+// applies the sizes recorded before the frame to render, see replay.h;
+// false once the recorded session is over
+bool replayEvents() {
+    ReplayEvent event;
+    while (replay.poll(event)) {
+        if (event.type == ReplayEvent::RESIZE) {
+            headless.resize(event.x, event.y);
+            reshape(event.x, event.y);
+        }
+    }
+    if (replay.ended() && !headless.active()) {
+        renderThread.setPaused(true);
+        g_idle_add(quit, nullptr);
+        return false;
+    }
+    return true;
+}
+
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial05: %d FPS @ %d x %d", frameCount, currentWidth, currentHeight);
-    gtk_window_set_title(GTK_WINDOW(window), title);
-    frameCount = 0;
+    sprintf(title, "Tutorial05: %.0f FPS (%s) @ %d x %d",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight);
+    if (window != nullptr) {
+        g_idle_add(setTitle, g_strdup(title));
+    }
 }
 
-gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
-
-    static GdkGLContext* glcontext;
-    static GdkGLDrawable* gldrawable;
+// renders a frame with the context current
+void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
-
-        glcontext = gtk_widget_get_gl_context(widget);
-        gldrawable = gtk_widget_get_gl_drawable (widget);
-        gdk_gl_drawable_gl_begin(gldrawable, glcontext);
-        glewInit(); // must be called AFTER the OpenGL context has been created
-
+        Tracer::Scope trace("init");
         glEnable(GL_TEXTURE_2D);
         glEnable (GL_BLEND);
         glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -440,14 +471,18 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
         createProgram();
         createTexture();
         createCube();
-        startTimeMillis = currentTimeMillis();
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    if (!replayEvents()) {
+        return;
+    }
+    frameClock.beginFrame();
+    gpuProfiler.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 1000) {
         timer(0);
@@ -455,7 +490,7 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -470,15 +505,15 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     multm(mvp, frustumMat, mv);
 
     // activate the texture
-    glBindTexture(GL_TEXTURE_2D, textureId);
+    texture.bind();
     glActiveTexture(GL_TEXTURE0);
 
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint colorUniform = glGetUniformLocation(programId, "color");
-    GLuint textureUniform = glGetUniformLocation(programId, "texture");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint colorUniform = glGetUniformLocation(program.getId(), "color");
+    GLuint textureUniform = glGetUniformLocation(program.getId(), "texture");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp);
     glUniformMatrix4fv(mvMatrixUniform, 1, false, mv);
     glUniform3f(lightDirUniform, 0.0f, 0.0f, -1.0f);
@@ -488,50 +523,95 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     // render!
     glDisable(GL_DEPTH_TEST);
     glFrontFace(GL_CW);
+    gpuProfiler.begin("back faces");
     renderCube();
+    gpuProfiler.end();
     glEnable(GL_DEPTH_TEST);
     glFrontFace(GL_CCW);
+    gpuProfiler.begin("front faces");
     renderCube();
+    gpuProfiler.end();
 
     // display rendering buffer
-    gdk_gl_drawable_swap_buffers(gldrawable);
-    return TRUE;
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            gdk_gl_drawable_swap_buffers(gldrawable);
+        }
+    }
+    frameClock.endFrame();
+    replay.endFrame();
 }
 
-gboolean idle(GtkWidget* widget) {
-    gdk_window_invalidate_rect(widget->window, &widget->allocation, FALSE);
-    gdk_window_process_updates(widget->window, FALSE);
+// the render thread redraws continuously, the exposed area with the rest
+gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     return TRUE;
 }
 
-
-void idle_add(GtkWidget* widget) {
-    if (idle_id == 0) {
-        idle_id = g_idle_add_full(GDK_PRIORITY_REDRAW, (GSourceFunc) idle, widget, NULL);
+// makes the context current on the render thread
+bool beginRendering() {
+    if (!gdk_gl_drawable_gl_begin(gldrawable, glcontext)) {
+        printf("Cannot make the GL context current\n");
+        return false;
     }
+    glewInit(); // must be called AFTER the OpenGL context has been created
+    gpuProfiler.startFromEnvironment();
+    return true;
 }
 
-void idle_remove(GtkWidget* widget) {
-    if (idle_id != 0) {
-        g_source_remove(idle_id);
-        idle_id = 0;
-    }
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    texture.reset();
+    cubePositions.reset();
+    cubeNormals.reset();
+    cubeTexCoords.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    gpuProfiler.finish();
+    releaseScene();
+    replay.finish();
+    Tracer::instance().finish();
+}
+
+// releases the GL objects and the context, on the render thread
+void endRendering() {
+    destroy();
+    gdk_gl_drawable_gl_end(gldrawable);
+}
+
+// any key quits; on the render thread, which leaves quitting to the main loop
+void keyPress(unsigned keyval) {
+    g_idle_add(quit, nullptr);
 }
 
+// the context is created with the window, rendering starts once it shows
 gboolean map(GtkWidget* widget, GdkEventAny* event, gpointer data) {
-    idle_add(widget);
+    if (!renderThread.started()) {
+        glcontext = gtk_widget_get_gl_context(widget);
+        gldrawable = gtk_widget_get_gl_drawable(widget);
+        renderThread.start(beginRendering, render, endRendering, resized, keyPress);
+    }
+    renderThread.setPaused(false);
     return TRUE;
 }
 
 gboolean unmap(GtkWidget* widget, GdkEventAny* event, gpointer data) {
-    idle_remove(widget);
+    renderThread.setPaused(true);
     return TRUE;
 }
 
-static gboolean key(GtkWidget* widget, GdkEventKey* event, gpointer data) {
-    GdkGLDrawable* gldrawable = gtk_widget_get_gl_drawable(widget);
-    gdk_gl_drawable_gl_end(gldrawable);
-    exit(0);
+gboolean key(GtkWidget* widget, GdkEventKey* event, gpointer data) {
+    renderThread.postKey(event->keyval);
+    return TRUE;
 }
 
 int main(int argc, char **argv) {
@@ -539,6 +619,26 @@ int main(int argc, char **argv) {
     GdkGLConfig* glconfig;
     GtkWidget* drawing_area;
 
+    headless.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        gpuProfiler.startFromEnvironment();
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
+    // the render thread swaps on the display connection of GTK
+    XInitThreads();
     gtk_init(&argc, &argv);
     gtk_gl_init(&argc, &argv);
 
@@ -554,7 +654,7 @@ int main(int argc, char **argv) {
     gtk_widget_add_events(drawing_area, GDK_VISIBILITY_NOTIFY_MASK);
 
     g_signal_connect(G_OBJECT(window), "delete_event", G_CALLBACK(gtk_main_quit), NULL);
-    g_signal_connect(G_OBJECT(drawing_area), "configure_event", G_CALLBACK(reshape), NULL);
+    g_signal_connect(G_OBJECT(drawing_area), "configure_event", G_CALLBACK(configure), NULL);
     g_signal_connect(G_OBJECT(drawing_area), "expose_event", G_CALLBACK(draw), NULL);
     g_signal_connect_swapped(G_OBJECT(window), "key_press_event", G_CALLBACK(key), drawing_area);
     g_signal_connect(G_OBJECT(drawing_area), "map_event", G_CALLBACK(map), NULL);
@@ -563,5 +663,6 @@ int main(int argc, char **argv) {
     gtk_widget_show(drawing_area);
     gtk_widget_show(window);
     gtk_main();
+    renderThread.stop();
     return 0;
 }
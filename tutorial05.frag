@@ -11,7 +11,8 @@ void main(void)
 {
     vec4 texColor = texture2D(texture, vTexCoord);
     if (texColor.a == 0.0f) {
-	    fColor = vec4(vColor, 0.7f);
+	    // premultiplied, like the texture
+	    fColor = vec4(vColor * 0.7f, 0.7f);
     } else {
         fColor = texColor;
     }
@@ -1,4 +1,3 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,9 +5,17 @@
 #include <math.h>
 #include <png.h>
 #include <GL/glew.h>
+#include <X11/Xlib.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtkgl.h>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "renderthread.h"
 
 /*
  * In this tutorial, we render a rotating torus with ambient, diffuse and
@@ -17,7 +24,6 @@
 
 typedef float matrix44[16];
 
-inline long currentTimeMillis() { return clock() / (CLOCKS_PER_SEC / 1000); }
 const float pi = atan(1.0f) * 4.0f;
 inline float toRadians(float degrees) { return degrees * pi / 180.0f; }
 
@@ -39,60 +45,28 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 GtkWidget *window;
-guint idle_id = 0;
+GdkGLContext* glcontext;
+GdkGLDrawable* gldrawable;
+// renders the frames while the main loop dispatches the events, see renderthread.h
+RenderThread renderThread;
 
 bool initialized = false;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-GLuint torusPositionsId;
-GLuint torusNormalsId;
+gl::Program program;
+gl::Buffer torusPositions;
+gl::Buffer torusNormals;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
 void frustum(matrix44 m, float left, float right, float bottom, float top, float near, float far) {
     m[0] = 2 * near / (right - left);
     m[1] = 0.0f;
@@ -165,27 +139,19 @@ void multm(matrix44 m, matrix44 m1, matrix44 m2) {
 }
 
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial06.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial06.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "vNormal");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial06.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource("tutorial06.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "vNormal");
+    program.link();
 }
 
 void torus(float u, float v, float r, float R, float **p) {
@@ -228,7 +194,7 @@ void torusNormal(int ui, int vi, int n, float r, float R, float **p) {
     *p += 3;
 }
 
-GLuint createTorusPositions(int n, float r, float R) {
+gl::Buffer createTorusPositions(int n, float r, float R) {
     int nfloats = torusAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     float *positions = (float*) malloc(bufferSize);
@@ -245,15 +211,12 @@ GLuint createTorusPositions(int n, float r, float R) {
             torus(ui*a, (vi+1)*a, r, R, &p);
         }
     }
-    GLuint torusPositionsId;
-    glGenBuffers(1, &torusPositionsId);
-    glBindBuffer(GL_ARRAY_BUFFER, torusPositionsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions, GL_STATIC_DRAW);
+    gl::Buffer torusPositions = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions);
     free(positions);
-    return torusPositionsId;
+    return torusPositions;
 }
 
-GLuint createTorusNormals(int n, float r, float R) {
+gl::Buffer createTorusNormals(int n, float r, float R) {
     int nfloats = torusAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     float *normals = (float*) malloc(bufferSize);
@@ -269,20 +232,17 @@ GLuint createTorusNormals(int n, float r, float R) {
             torusNormal(ui, vi+1, n, r, R, &p);
         }
     }
-    GLuint torusNormalsId;
-    glGenBuffers(1, &torusNormalsId);
-    glBindBuffer(GL_ARRAY_BUFFER, torusNormalsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals, GL_STATIC_DRAW);
+    gl::Buffer torusNormals = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals);
     free(normals);
-    return torusNormalsId;
+    return torusNormals;
 }
 
 void renderTorus() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, torusPositionsId);
+    glBindBuffer(GL_ARRAY_BUFFER, torusPositions.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, torusNormalsId);
+    glBindBuffer(GL_ARRAY_BUFFER, torusNormals.getId());
     glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, torusAttributeCount(n));
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -290,50 +250,92 @@ void renderTorus() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-gboolean reshape(GtkWidget* widget, GdkEventConfigure* event, gpointer data) {
-    int width = widget->allocation.width;
-    int height = widget->allocation.height;
+void reshape(int width, int height) {
     glViewport(0, 0, width, height);
     // we keep track of the aspect ratio to adjust the projection volume
     aspectRatio = 1.0f * width / height;
     currentWidth = width;
     currentHeight = height;
+}
+
+// the render thread owns the context and reshapes before its next frame
+gboolean configure(GtkWidget* widget, GdkEventConfigure* event, gpointer data) {
+    renderThread.postResize(widget->allocation.width, widget->allocation.height);
     return TRUE;
 }
 
+// GTK is only called from the main loop, the render thread posts the title
+gboolean setTitle(gpointer title) {
+    gtk_window_set_title(GTK_WINDOW(window), (const char*) title);
+    g_free(title);
+    return FALSE;
+}
+
+gboolean quit(gpointer data) {
+    gtk_main_quit();
+    return FALSE;
+}
+
+// the size of the window, on the render thread; while replaying, the sizes
+// come from the recording
+void resized(int width, int height) {
+    if (replay.replaying()) {
+        return;
+    }
+    replay.record(ReplayEvent::RESIZE, width, height);
+    reshape(width, height);
+}
+
+// applies the sizes recorded before the frame to render, see replay.h;
+// false once the recorded session is over
+bool replayEvents() {
+    ReplayEvent event;
+    while (replay.poll(event)) {
+        if (event.type == ReplayEvent::RESIZE) {
+            headless.resize(event.x, event.y);
+            reshape(event.x, event.y);
+        }
+    }
+    if (replay.ended() && !headless.active()) {
+        renderThread.setPaused(true);
+        g_idle_add(quit, nullptr);
+        return false;
+    }
+    return true;
+}
+
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial06: %d FPS @ %d x %d", frameCount, currentWidth, currentHeight);
-    gtk_window_set_title(GTK_WINDOW(window), title);
-    frameCount = 0;
+    sprintf(title, "Tutorial06: %.0f FPS (%s) @ %d x %d",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight);
+    if (window != nullptr) {
+        g_idle_add(setTitle, g_strdup(title));
+    }
 }
 
-gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
-
-    static GdkGLContext* glcontext;
-    static GdkGLDrawable* gldrawable;
+// renders a frame with the context current
+void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
-
-        glcontext = gtk_widget_get_gl_context(widget);
-        gldrawable = gtk_widget_get_gl_drawable (widget);
-        gdk_gl_drawable_gl_begin(gldrawable, glcontext);
-        glewInit(); // must be called AFTER the OpenGL context has been created
-
+        Tracer::Scope trace("init");
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
-        torusPositionsId = createTorusPositions(n, 0.3f, 1.0f);
-        torusNormalsId = createTorusNormals(n, 0.3f, 1.0f);
+        torusPositions = createTorusPositions(n, 0.3f, 1.0f);
+        torusNormals = createTorusNormals(n, 0.3f, 1.0f);
         createProgram();
-        startTimeMillis = currentTimeMillis();
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    if (!replayEvents()) {
+        return;
+    }
+    frameClock.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 1000) {
         timer(0);
@@ -341,7 +343,7 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -356,11 +358,11 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     multm(mvp, frustumMat, mv);
 
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint colorUniform = glGetUniformLocation(programId, "color");
-    GLuint ambientUniform = glGetUniformLocation(programId, "ambient");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint colorUniform = glGetUniformLocation(program.getId(), "color");
+    GLuint ambientUniform = glGetUniformLocation(program.getId(), "ambient");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp);
     glUniformMatrix4fv(mvMatrixUniform, 1, false, mv);
     glUniform3f(lightDirUniform, 1.0f, -1.0f, -1.0f);
@@ -371,43 +373,81 @@ gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     renderTorus();
 
     // display rendering buffer
-    gdk_gl_drawable_swap_buffers(gldrawable);
-    return TRUE;
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            gdk_gl_drawable_swap_buffers(gldrawable);
+        }
+    }
+    frameClock.endFrame();
+    replay.endFrame();
 }
 
-gboolean idle(GtkWidget* widget) {
-    gdk_window_invalidate_rect(widget->window, &widget->allocation, FALSE);
-    gdk_window_process_updates(widget->window, FALSE);
+// the render thread redraws continuously, the exposed area with the rest
+gboolean draw(GtkWidget* widget, GdkEventExpose* event, gpointer data) {
     return TRUE;
 }
 
-void idle_add(GtkWidget* widget) {
-    if (idle_id == 0) {
-        idle_id = g_idle_add_full(GDK_PRIORITY_REDRAW, (GSourceFunc) idle, widget, NULL);
+// makes the context current on the render thread
+bool beginRendering() {
+    if (!gdk_gl_drawable_gl_begin(gldrawable, glcontext)) {
+        printf("Cannot make the GL context current\n");
+        return false;
     }
+    glewInit(); // must be called AFTER the OpenGL context has been created
+    return true;
 }
 
-void idle_remove(GtkWidget* widget) {
-    if (idle_id != 0) {
-        g_source_remove(idle_id);
-        idle_id = 0;
-    }
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    torusPositions.reset();
+    torusNormals.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    releaseScene();
+    replay.finish();
+    Tracer::instance().finish();
+}
+
+// releases the GL objects and the context, on the render thread
+void endRendering() {
+    destroy();
+    gdk_gl_drawable_gl_end(gldrawable);
+}
+
+// any key quits; on the render thread, which leaves quitting to the main loop
+void keyPress(unsigned keyval) {
+    g_idle_add(quit, nullptr);
 }
 
+// the context is created with the window, rendering starts once it shows
 gboolean map(GtkWidget* widget, GdkEventAny* event, gpointer data) {
-    idle_add(widget);
+    if (!renderThread.started()) {
+        glcontext = gtk_widget_get_gl_context(widget);
+        gldrawable = gtk_widget_get_gl_drawable(widget);
+        renderThread.start(beginRendering, render, endRendering, resized, keyPress);
+    }
+    renderThread.setPaused(false);
     return TRUE;
 }
 
 gboolean unmap(GtkWidget* widget, GdkEventAny* event, gpointer data) {
-    idle_remove(widget);
+    renderThread.setPaused(true);
     return TRUE;
 }
 
 gboolean key(GtkWidget* widget, GdkEventKey* event, gpointer data) {
-    GdkGLDrawable* gldrawable = gtk_widget_get_gl_drawable(widget);
-    gdk_gl_drawable_gl_end(gldrawable);
-    exit(0);
+    renderThread.postKey(event->keyval);
+    return TRUE;
 }
 
 int main(int argc, char **argv) {
@@ -415,6 +455,25 @@ int main(int argc, char **argv) {
     GdkGLConfig* glconfig;
     GtkWidget* drawing_area;
 
+    headless.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
+    // the render thread swaps on the display connection of GTK
+    XInitThreads();
     gtk_init(&argc, &argv);
     gtk_gl_init(&argc, &argv);
 
@@ -430,7 +489,7 @@ int main(int argc, char **argv) {
     gtk_widget_add_events(drawing_area, GDK_VISIBILITY_NOTIFY_MASK);
 
     g_signal_connect(G_OBJECT(window), "delete_event", G_CALLBACK(gtk_main_quit), NULL);
-    g_signal_connect(G_OBJECT(drawing_area), "configure_event", G_CALLBACK(reshape), NULL);
+    g_signal_connect(G_OBJECT(drawing_area), "configure_event", G_CALLBACK(configure), NULL);
     g_signal_connect(G_OBJECT(drawing_area), "expose_event", G_CALLBACK(draw), NULL);
     g_signal_connect_swapped(G_OBJECT(window), "key_press_event", G_CALLBACK(key), drawing_area);
     g_signal_connect(G_OBJECT(drawing_area), "map_event", G_CALLBACK(map), NULL);
@@ -439,5 +498,6 @@ int main(int argc, char **argv) {
     gtk_widget_show(drawing_area);
     gtk_widget_show(window);
     gtk_main();
+    renderThread.stop();
     return 0;
 }
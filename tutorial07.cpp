@@ -1,12 +1,21 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include <SDL/SDL.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
 #include <GL/glxew.h>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "capture.h"
 
 /*
  * In this tutorial, we render a rotating torus with ambient, diffuse and
@@ -15,7 +24,6 @@
 
 typedef float matrix44[16];
 
-inline long currentTimeMillis() { return clock() / (CLOCKS_PER_SEC / 1000); }
 const float pi = atan(1.0f) * 4.0f;
 inline float toRadians(float degrees) { return degrees * pi / 180.0f; }
 
@@ -37,57 +45,28 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-GLuint torusPositionsId;
-GLuint torusNormalsId;
+gl::Program program;
+gl::Buffer torusPositions;
+gl::Buffer torusNormals;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
 void frustum(matrix44 m, float left, float right, float bottom, float top, float near, float far) {
     m[0] = 2 * near / (right - left);
     m[1] = 0.0f;
@@ -160,27 +139,19 @@ void multm(matrix44 m, matrix44 m1, matrix44 m2) {
 }
 
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial07.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial07.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "vNormal");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial07.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource("tutorial07.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "vNormal");
+    program.link();
 }
 
 void torus(float u, float v, float r, float R, float **p) {
@@ -223,7 +194,7 @@ void torusNormal(int ui, int vi, int n, float r, float R, float **p) {
     *p += 3;
 }
 
-GLuint createTorusPositions(int n, float r, float R) {
+gl::Buffer createTorusPositions(int n, float r, float R) {
     int nfloats = torusAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     float *positions = (float*) malloc(bufferSize);
@@ -240,15 +211,12 @@ GLuint createTorusPositions(int n, float r, float R) {
             torus(ui*a, (vi+1)*a, r, R, &p);
         }
     }
-    GLuint torusPositionsId;
-    glGenBuffers(1, &torusPositionsId);
-    glBindBuffer(GL_ARRAY_BUFFER, torusPositionsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions, GL_STATIC_DRAW);
+    gl::Buffer torusPositions = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions);
     free(positions);
-    return torusPositionsId;
+    return torusPositions;
 }
 
-GLuint createTorusNormals(int n, float r, float R) {
+gl::Buffer createTorusNormals(int n, float r, float R) {
     int nfloats = torusAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     float *normals = (float*) malloc(bufferSize);
@@ -264,20 +232,17 @@ GLuint createTorusNormals(int n, float r, float R) {
             torusNormal(ui, vi+1, n, r, R, &p);
         }
     }
-    GLuint torusNormalsId;
-    glGenBuffers(1, &torusNormalsId);
-    glBindBuffer(GL_ARRAY_BUFFER, torusNormalsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals, GL_STATIC_DRAW);
+    gl::Buffer torusNormals = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals);
     free(normals);
-    return torusNormalsId;
+    return torusNormals;
 }
 
 void renderTorus() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, torusPositionsId);
+    glBindBuffer(GL_ARRAY_BUFFER, torusPositions.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, torusNormalsId);
+    glBindBuffer(GL_ARRAY_BUFFER, torusNormals.getId());
     glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, torusAttributeCount(n));
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -296,27 +261,29 @@ void reshape(int width, int height) {
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial07: %d FPS @ %d x %d", frameCount * 4, currentWidth, currentHeight);
+    sprintf(title, "Tutorial07: %.0f FPS (%s) @ %d x %d",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight);
     SDL_WM_SetCaption(title, title);
-    frameCount = 0;
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
-        torusPositionsId = createTorusPositions(n, 0.3f, 1.0f);
-        torusNormalsId = createTorusNormals(n, 0.3f, 1.0f);
+        torusPositions = createTorusPositions(n, 0.3f, 1.0f);
+        torusNormals = createTorusNormals(n, 0.3f, 1.0f);
         createProgram();
-        startTimeMillis = currentTimeMillis();
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    frameClock.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 250) {
         timer(0);
@@ -324,7 +291,7 @@ void render() {
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -339,11 +306,11 @@ void render() {
     multm(mvp, frustumMat, mv);
 
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint colorUniform = glGetUniformLocation(programId, "color");
-    GLuint ambientUniform = glGetUniformLocation(programId, "ambient");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint colorUniform = glGetUniformLocation(program.getId(), "color");
+    GLuint ambientUniform = glGetUniformLocation(program.getId(), "ambient");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp);
     glUniformMatrix4fv(mvMatrixUniform, 1, false, mv);
     glUniform3f(lightDirUniform, 1.0f, -1.0f, -1.0f);
@@ -353,12 +320,63 @@ void render() {
     // render!
     renderTorus();
 
+    capture.capture();
     // display rendering buffer
-    SDL_GL_SwapBuffers();
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    torusPositions.reset();
+    torusNormals.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_EVERYTHING);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
@@ -374,7 +392,9 @@ int main(int argc, char **argv) {
     // must be called AFTER the OpenGL context has been created
     glewInit();
     reshape(800, 600);
+    capture.startFromEnvironment(800, 600);
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -383,9 +403,16 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
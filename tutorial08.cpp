@@ -1,13 +1,22 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include <SDL/SDL.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
 #include <GL/glxew.h>
 #include <vector>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "capture.h"
 
 /*
  * In this tutorial, we render a rotating sphere lighted with ambient
@@ -39,7 +48,6 @@ vector3 midPoint(vector3 p1, vector3 p2) {
     return vector3((p1.x + p2.x) / 2, (p1.y + p2.y) / 2, (p1.z + p2.z) / 2);
 }
 
-inline long currentTimeMillis() { return clock() / (CLOCKS_PER_SEC / 1000); }
 const float pi = atan(1.0f) * 4.0f;
 inline float toRadians(float degrees) { return degrees * pi / 180.0f; }
 
@@ -61,59 +69,30 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-GLuint spherePositionsId;
-GLuint sphereNormalsId;
+gl::Program program;
+gl::Buffer spherePositions;
+gl::Buffer sphereNormals;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
 float* positions;
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
 void frustum(matrix44 m, float left, float right, float bottom, float top, float near, float far) {
     m[0] = 2 * near / (right - left);
     m[1] = 0.0f;
@@ -199,12 +178,11 @@ void refine(int depth, triangle t, float** p) {
     }
 }
 
-GLuint createSpherePositions() {
+gl::Buffer createSpherePositions() {
     int nfloats = sphereAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     positions = (float*) malloc(bufferSize);
     float* p = positions;
-    GLuint spherePositionsId;
 
     //
     // we refine each side of an octahedron
@@ -219,20 +197,16 @@ GLuint createSpherePositions() {
     refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p);
     refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p);
 
-    glGenBuffers(1, &spherePositionsId);
-    glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions, GL_STATIC_DRAW);
-    //free(positions);
-    return spherePositionsId;
+    gl::Buffer spherePositions = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), positions);
+    return spherePositions;
 }
 
-GLuint createSphereNormals(float* positions) {
+gl::Buffer createSphereNormals(float* positions) {
     int nfloats = sphereAttributeCount(n)*3; // number of floats in the buffer
     int bufferSize = nfloats*sizeof(float);
     float* normals = (float*) malloc(bufferSize);
     float* n = normals;
     float* p = positions;
-    GLuint sphereNormalsId;
 
     for (int i = 0; i < nfloats; i+=9) {
         float nx = (p[i+0] + p[i+3] + p[i+6]) / 3;
@@ -243,35 +217,25 @@ GLuint createSphereNormals(float* positions) {
         n[i+2] = n[i+5] = n[i+8] = nz;
     }
 
-    glGenBuffers(1, &sphereNormalsId);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereNormalsId);
-    glBufferData(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals, GL_STATIC_DRAW);
+    gl::Buffer sphereNormals = gl::Buffer::create(GL_ARRAY_BUFFER, nfloats*sizeof(float), normals);
     free(normals);
-    return sphereNormalsId;
+    return sphereNormals;
 }
 
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial08.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial08.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "vNormal");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial08.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource("tutorial08.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "vNormal");
+    program.link();
 }
 
 void reshape(int width, int height) {
@@ -285,17 +249,17 @@ void reshape(int width, int height) {
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial08: %d FPS @ %d x %d", frameCount * 4, currentWidth, currentHeight);
+    sprintf(title, "Tutorial08: %.0f FPS (%s) @ %d x %d",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight);
     SDL_WM_SetCaption(title, title);
-    frameCount = 0;
 }
 
 void renderSphere() {
     glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
+    glBindBuffer(GL_ARRAY_BUFFER, spherePositions.getId());
     glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereNormalsId);
+    glBindBuffer(GL_ARRAY_BUFFER, sphereNormals.getId());
     glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glDrawArrays(GL_TRIANGLES, 0, sphereAttributeCount(n));
     glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
@@ -304,21 +268,24 @@ void renderSphere() {
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
-        spherePositionsId = createSpherePositions();
-        sphereNormalsId = createSphereNormals(positions);
+        spherePositions = createSpherePositions();
+        sphereNormals = createSphereNormals(positions);
+        free(positions);
         createProgram();
-        startTimeMillis = currentTimeMillis();
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    frameClock.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 250) {
         timer(0);
@@ -326,7 +293,7 @@ void render() {
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -341,11 +308,11 @@ void render() {
     multm(mvp, frustumMat, mv);
 
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint colorUniform = glGetUniformLocation(programId, "color");
-    GLuint ambientUniform = glGetUniformLocation(programId, "ambient");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint colorUniform = glGetUniformLocation(program.getId(), "color");
+    GLuint ambientUniform = glGetUniformLocation(program.getId(), "ambient");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp);
     glUniformMatrix4fv(mvMatrixUniform, 1, false, mv);
     glUniform3f(lightDirUniform, 1.0f, -1.0f, -1.0f);
@@ -355,12 +322,63 @@ void render() {
     // render!
     renderSphere();
 
+    capture.capture();
     // display rendering buffer
-    SDL_GL_SwapBuffers();
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    spherePositions.reset();
+    sphereNormals.reset();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_EVERYTHING);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
@@ -376,7 +394,9 @@ int main(int argc, char **argv) {
     // must be called AFTER the OpenGL context has been created
     glewInit();
     reshape(900, 900);
+    capture.startFromEnvironment(900, 900);
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -388,9 +408,16 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
@@ -1,19 +1,54 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <SDL/SDL.h>
-#include <SDL/SDL_image.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
 #include <GL/glxew.h>
 #include <vector>
 #include <stack>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "gpuprofiler.h"
+#include "capture.h"
+#include "texcompress.h"
+#include "image.h"
+#include "workerpool.h"
+#include "texcache.h"
+#include "cubemap.h"
+#include "cubetexture.h"
+#include "triplebuffer.h"
 
 /*
  * In this tutorial, we render a rotating sphere which combines 2 textures:
  * one for the earth under day light, the other for the earth under night lighting.
+ * By default both come from a single texture, earth_day_night.png, made by the packer
+ * tool from the colors of the day image and the luminance of the night image; the
+ * -separate option samples the two images from two textures instead. The images are
+ * resampled into cube maps when loaded, which the sphere samples with the direction
+ * of each fragment from its center, so it needs no texture coordinates.
+ * The two images were once the layers of one array texture; OpenGL 3.3 has no cube
+ * map arrays, so the packed image is what now keeps them in a single texture.
+ *
+ * The animation runs on an update thread of its own, 60 times a second by default
+ * (-updates N), which hands the transforms and uniforms of each frame to the render
+ * thread as a packet through a triple buffer, so that neither waits for the other;
+ * -inline updates in render() instead. -load N adds N objects for the update thread
+ * to animate, which are not drawn, as a scene with that many objects would.
  */
 
 // C/C++ does not have a default definition for pi!
@@ -23,12 +58,6 @@ inline float toRadians(float degrees) {
     return degrees * pi / 180.0f;
 }
 
-class vector2 {
-public:
-    vector2(float x, float y): x(x), y(y) {}
-    const float x, y;
-};
-
 class vector3 {
 public:
     vector3(float x, float y, float z): x(x), y(y), z(z) {}
@@ -44,10 +73,6 @@ vector3 midPoint(vector3 p1, vector3 p2) {
     return vector3((p1.x + p2.x) / 2, (p1.y + p2.y) / 2, (p1.z + p2.z) / 2);
 }
 
-inline long currentTimeMillis() {
-	return clock() / (CLOCKS_PER_SEC / 1000);
-}
-
 class matrix44 {
 public:
 	matrix44 multm(const matrix44& m2) {
@@ -140,6 +165,15 @@ matrix44 translate(float x, float y, float z) {
 	return translateMatrix;
 }
 
+matrix44 scale(float s) {
+    matrix44 scaleMatrix = identity();
+    float* m = scaleMatrix.f;
+    m[0] = s;
+    m[5] = s;
+    m[10] = s;
+    return scaleMatrix;
+}
+
 matrix44 rotate(float a, float x, float y, float z) {
 	matrix44 rotateMatrix;
 	float* m = rotateMatrix.f;
@@ -178,61 +212,9 @@ public:
     std::stack<matrix44> s;
 };
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
 // Up to 16 attributes per vertex is allowed so any value between 0 and 15 will do.
 const int POSITION_ATTRIBUTE_INDEX = 0;
 const int NORMAL_ATTRIBUTE_INDEX = 1;
-const int TEXCOORD_ATTRIBUTE_INDEX = 2;
-
-// a class for managing a texture
-class Texture {
-
-public:
-
-    Texture(const std::string& s) {
-        imageFile = s;
-    }
-
-    void init() {
-        SDL_Surface *image = IMG_Load(imageFile.c_str());
-        if(!image) {
-            printf("IMG_Load: %s\n", IMG_GetError());
-        }
-        int width = image->w;
-        int height = image->h;
-        SDL_Surface* rgbaImage = SDL_CreateRGBSurface(0, width, height, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
-        SDL_BlitSurface(image, 0, rgbaImage, 0);
-        GLenum format = GL_RGBA;
-        
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, rgbaImage->pixels);
-    }
-
-    GLuint getId() {
-        return textureId;
-    }
-
-private:
-
-    std::string imageFile;
-    GLuint textureId;
-};
 
 // a class for calculating the vertices and drawing a sphere
 class Sphere {
@@ -240,112 +222,86 @@ class Sphere {
 public:
     
     void init() {
+        Tracer::Scope trace("Sphere::init");
         float* positions;
         float* normals;
-        float* texcoords;
         
         int psize = sphereAttributeCount(depth)*3*sizeof(float);
         int nsize = sphereAttributeCount(depth)*3*sizeof(float);
-        int tsize = sphereAttributeCount(depth)*2*sizeof(float);
         
         positions = (float*) malloc(psize);
         normals = (float*) malloc(nsize);
-        texcoords = (float*) malloc(tsize);
         
-        createSphereAttributes(positions, normals, texcoords);
+        createSphereAttributes(positions, normals);
         
-        glGenBuffers(1, &spherePositionsId);
-        glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
-        glBufferData(GL_ARRAY_BUFFER, psize, positions, GL_STATIC_DRAW);
+        // the vertex array records the attribute setup below, so that rendering
+        // only needs to bind it
+        vertexArray = gl::VertexArray::create();
+        spherePositions = gl::Buffer::create(GL_ARRAY_BUFFER, psize, positions);
+        glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
+        glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-        glGenBuffers(1, &sphereNormalsId);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereNormalsId);
-        glBufferData(GL_ARRAY_BUFFER, nsize, normals, GL_STATIC_DRAW);
-        
-        glGenBuffers(1, &sphereTexCoordsId);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereTexCoordsId);
-        glBufferData(GL_ARRAY_BUFFER, tsize, texcoords, GL_STATIC_DRAW);
+        sphereNormals = gl::Buffer::create(GL_ARRAY_BUFFER, nsize, normals);
+        glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
+        glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         free(positions);
         free(normals);
-        free(texcoords);
     }
     
     void render() {
-        glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
-        glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereNormalsId);
-        glVertexAttribPointer(NORMAL_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereTexCoordsId);
-        glVertexAttribPointer(TEXCOORD_ATTRIBUTE_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);        
+        vertexArray.bind();
         glDrawArrays(GL_TRIANGLES, 0, sphereAttributeCount(depth));
-        glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-        glDisableVertexAttribArray(NORMAL_ATTRIBUTE_INDEX);
-        glDisableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        vertexArray.reset();
+        spherePositions.reset();
+        sphereNormals.reset();
     }
     
 private:
 
-    GLuint spherePositionsId;
-    GLuint sphereNormalsId;
-    GLuint sphereTexCoordsId;
+    gl::VertexArray vertexArray;
+    gl::Buffer spherePositions;
+    gl::Buffer sphereNormals;
     
     static const int depth = 4;
 
     inline int sphereAttributeCount(int n) { return 8 * pow(4, n) * 3; }
 
-    inline vector2 cart2geog(vector3 p) { return vector2(atan2(p.y, p.x), asin(p.z)); }
-
-    void texCoord(float** t, vector3 p, triangle tr) {
-        vector2 geog = cart2geog(p);
-        vector2 geogtr = cart2geog(tr.center());
-        float lat = geog.y;
-        float lon = geog.x;
-        float t1 = lon / (2.0f*pi) + 0.5f;
-        float t2 = -1.0f * lat / pi + 0.5f;
-        if (t1 == 1.0f && geogtr.x < 0.5f) { t1 = 0.0f; }
-        if (t1 == 0.0f && geogtr.x > 0.5f) { t1 = 1.0f; }       
-        **t = t1;
-        (*t)++;
-        **t = t2;
-        (*t)++;
-    }
-
-    void refine(int d, triangle tr, float** p, float** n, float** t) {
+    void refine(int d, triangle tr, float** p, float** n) {
         if (d == depth) {
             tr.dump(p);
             tr.dump(n);
-            texCoord(t, tr.p1, tr);
-            texCoord(t, tr.p2, tr);
-            texCoord(t, tr.p3, tr);
         } else {
             vector3 m1 = midPoint(tr.p2, tr.p3).normalize();
             vector3 m2 = midPoint(tr.p3, tr.p1).normalize();
             vector3 m3 = midPoint(tr.p1, tr.p2).normalize();
-            refine(d + 1, triangle(tr.p1, m3, m2), p, n, t);
-            refine(d + 1, triangle(m3, tr.p2, m1), p, n, t);
-            refine(d + 1, triangle(m1, m2, m3), p, n, t);
-            refine(d + 1, triangle(m2, m1, tr.p3), p, n, t);
+            refine(d + 1, triangle(tr.p1, m3, m2), p, n);
+            refine(d + 1, triangle(m3, tr.p2, m1), p, n);
+            refine(d + 1, triangle(m1, m2, m3), p, n);
+            refine(d + 1, triangle(m2, m1, tr.p3), p, n);
         }
     }
 
-    void createSphereAttributes(float* p, float* n, float* t) {
+    void createSphereAttributes(float* p, float* n) {
         //
         // we refine each side of an octahedron
         // cf http://paulbourke.net/miscellaneous/sphere_cylinder/
         //
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &n, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &n, &t);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &n);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &n);
     }
 
 };
@@ -359,68 +315,76 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-Texture textureDay("earth_day.jpg");
-Texture textureNight("earth_night.jpg");
+gl::Program program;
+// the day colors and the night luminance in one RGBA texture, one fetch per fragment
+CubeTexture earthPacked("earth_day_night.png", BLOCK_BC3);
+// or the day and night images in textures of their own, two fetches
+CubeTexture earthDay("earth_day.jpg", BLOCK_BC1);
+CubeTexture earthNight("earth_night.jpg", BLOCK_BC1);
+// false with the -separate option
+bool packedLayers = true;
+// the number of globes drawn, given on the command line
+int globeCount = 1;
 Sphere sphere;
 
-float aspectRatio;
-int frameCount;
+// written by reshape(), read by the update thread
+std::atomic<float> aspectRatio;
+// times the frames, see frameclock.h
+FrameClock frameClock;
+// times the passes when CGLCORE_GPU_PROFILE is set, see gpuprofiler.h
+GpuProfiler gpuProfiler;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
+// what render() draws of a globe
+struct GlobeDraw {
+    matrix44 mvp;
+    matrix44 mv;
+};
 
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
+// the state of a frame, built by update() and left alone once published
+struct FramePacket {
+    long elapsed;
+    std::vector<GlobeDraw> globes;
+};
+
+// from the update thread to the render thread, see triplebuffer.h
+TripleBuffer<FramePacket> packets;
+std::thread updater;
+std::atomic<bool> updating(false);
+// true with the -inline option
+bool inlineUpdate = false;
+int updatesPerSecond = 60;
+int loadObjects = 0;
+// the objects of the -load option
+std::vector<matrix44> loadTransforms;
 
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial09.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial09.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glBindAttribLocation(programId, NORMAL_ATTRIBUTE_INDEX, "vNormal");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial09.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource(packedLayers ? "tutorial09_packed.frag" : "tutorial09.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.bindAttribLocation(NORMAL_ATTRIBUTE_INDEX, "vNormal");
+    program.link();
 }
 
 void reshape(int width, int height) {
@@ -431,93 +395,265 @@ void reshape(int width, int height) {
     currentHeight = height;
 }
 
+// builds the packet of the frame elapsed ms into the animation
+void update(FramePacket& packet, long elapsed) {
+    Tracer::Scope trace("update");
+    packet.elapsed = elapsed;
+    packet.globes.resize(globeCount);
+    matrix44 frustumMat = frustum(left, right, bottom / aspectRatio, top / aspectRatio, nearPlane, farPlane);
+
+    // the globes are laid out on a grid of columns x columns cells
+    int columns = (int) ceil(sqrt((float) globeCount));
+    float cellSize = 3.0f / columns;
+    for (int i = 0; i < globeCount; i++) {
+        float x = (i % columns - (columns - 1) / 2.0f) * cellSize;
+        float y = ((columns - 1) / 2.0f - i / columns) * cellSize;
+
+        //
+        // calculate the ModelViewProjection and ModelViewProjection matrices
+        //
+        mstack mvp;
+        mstack mv;
+
+        matrix44 translateMat = translate(x, y, -3.0f);
+        matrix44 scaleMat = scale(1.0f / columns);
+        matrix44 rotateMat1 = rotate(-90, 1.0f, 0.0f, 0.0f);
+        matrix44 rotateMat2 = rotate(-90, 0.0f, 0.0f, 1.0f);
+        matrix44 rotateMat3 = rotate(1.0f * elapsed / 50, 0.0f, 0.0f, 1.0f);
+
+        mvp.push(frustumMat);
+        mvp.push(translateMat);
+        mvp.push(scaleMat);
+        mvp.push(rotateMat1);
+        mvp.push(rotateMat2);
+        mvp.push(rotateMat3);
+
+        // the normals only need the rotations, scaling them would dim the lighting
+        mv.push(translateMat);
+        mv.push(rotateMat1);
+        mv.push(rotateMat2);
+        mv.push(rotateMat3);
+
+        GlobeDraw& globe = packet.globes[i];
+        globe.mvp = mvp.top();
+        globe.mv = mv.top();
+    }
+
+    // the -load objects spin on circles of their own
+    for (size_t i = 0; i < loadTransforms.size(); i++) {
+        float angle = 1.0f * elapsed / 50 + i;
+        loadTransforms[i] = translate(cos(toRadians(angle)), sin(toRadians(angle)), -5.0f)
+            .multm(rotate(angle, 0.0f, 0.0f, 1.0f)).multm(scale(0.01f));
+    }
+}
+
+// publishes a packet for each tick of updatesPerSecond; a late tick is not
+// made up for
+void updateLoop() {
+    Tracer::instance().setThreadName("update");
+    std::chrono::microseconds period(1000000 / updatesPerSecond);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (updating) {
+        update(packets.back(), currentTimeMillis() - startTimeMillis);
+        packets.publish();
+        next = std::max(next + period, std::chrono::steady_clock::now());
+        std::this_thread::sleep_until(next);
+    }
+}
+
+// the first packet is built here, so that the first frame has one to draw
+void startUpdates() {
+    loadTransforms.resize(loadObjects);
+    update(packets.back(), 0);
+    packets.publish();
+    if (!inlineUpdate) {
+        updating = true;
+        updater = std::thread(updateLoop);
+    }
+}
+
+void stopUpdates() {
+    if (updater.joinable()) {
+        updating = false;
+        updater.join();
+    }
+}
+
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial09: %d FPS @ %d x %d", frameCount * 4, currentWidth, currentHeight);
+    sprintf(title, "Tutorial09: %.0f FPS (%s) @ %d x %d, %d globes, %s layers, %d texture binds per frame",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight, globeCount, packedLayers ? "packed" : "separate", CubeTexture::binds());
     SDL_WM_SetCaption(title, title);
-    frameCount = 0;
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         glEnable(GL_TEXTURE_2D);    
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
-        sphere.init();
-        textureDay.init();
-        textureNight.init();
-        createProgram();
-        startTimeMillis = currentTimeMillis();
+        // filters across the edges of the cube faces
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        {
+            // the images are decoded in parallel while the sphere and the program are set up
+            WorkerPool pool;
+            if (packedLayers) {
+                earthPacked.load(pool);
+            } else {
+                earthDay.load(pool);
+                earthNight.load(pool);
+            }
+            sphere.init();
+            createProgram();
+            CubeTexture* textures[] = { &earthPacked, &earthDay, &earthNight };
+            uploadWhenReady(textures, 3);
+        }
+        startTimeMillis = replay.now();
+        startUpdates();
         initialized = true;
     }
 
-    frameCount++;
+    frameClock.beginFrame();
+    gpuProfiler.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 250) {
         timer(0);
         lastTimerCall = now;
     }
 
+    if (inlineUpdate) {
+        update(packets.back(), elapsed);
+        packets.publish();
+    }
+    packets.acquire();
+    const FramePacket& packet = packets.front();
+
+    gpuProfiler.begin("clear");
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    gpuProfiler.end();
+    program.use();
+    CubeTexture::binds() = 0;
+
+    // the binds serve every globe
+    if (packedLayers) {
+        earthPacked.bind(0);
+    } else {
+        earthDay.bind(0);
+        earthNight.bind(1);
+    }
 
-    //
-    // calculate the ModelViewProjection and ModelViewProjection matrices
-    //
-    mstack mvp;
-    mstack mv;
-    
-    matrix44 frustumMat = frustum(left, right, bottom / aspectRatio, top / aspectRatio, nearPlane, farPlane);
-    matrix44 translateMat = translate(0.0f, 0.0f, -3.0f);
-    matrix44 rotateMat1 = rotate(-90, 1.0f, 0.0f, 0.0f);
-    matrix44 rotateMat2 = rotate(-90, 0.0f, 0.0f, 1.0f);
-    matrix44 rotateMat3 = rotate(1.0f * elapsed / 50, 0.0f, 0.0f, 1.0f);
-
-    mvp.push(frustumMat);
-    mvp.push(translateMat);
-    mvp.push(rotateMat1);
-    mvp.push(rotateMat2);
-    mvp.push(rotateMat3);
-
-    mv.push(translateMat);
-    mv.push(rotateMat1);
-    mv.push(rotateMat2);
-    mv.push(rotateMat3);
-    
-    // activate the textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureDay.getId());
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, textureNight.getId());
-    
-    // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint mvMatrixUniform = glGetUniformLocation(programId, "mvMatrix");
-    GLuint textureDayUniform = glGetUniformLocation(programId, "textureDay");
-    GLuint textureNightUniform = glGetUniformLocation(programId, "textureNight");
-    GLuint ambientUniform = glGetUniformLocation(programId, "ambient");
-    GLuint lightDirUniform = glGetUniformLocation(programId, "lightDir");
-    glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp.top().f);
-    glUniformMatrix4fv(mvMatrixUniform, 1, false, mv.top().f);
+    // set the uniforms shared by the globes
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint mvMatrixUniform = glGetUniformLocation(program.getId(), "mvMatrix");
+    GLuint earthPackedUniform = glGetUniformLocation(program.getId(), "earthPacked");
+    GLuint earthDayUniform = glGetUniformLocation(program.getId(), "earthDay");
+    GLuint earthNightUniform = glGetUniformLocation(program.getId(), "earthNight");
+    GLuint ambientUniform = glGetUniformLocation(program.getId(), "ambient");
+    GLuint lightDirUniform = glGetUniformLocation(program.getId(), "lightDir");
     glUniform3f(lightDirUniform, 1.0f, 0.0f, -0.5f);
     glUniform4f(ambientUniform, 0.1f, 0.1f, 0.1f, 1.0f);
-    glUniform1i(textureDayUniform, 0);
-    glUniform1i(textureNightUniform, 1);
-
-    // render!
-    sphere.render();
+    glUniform1i(earthPackedUniform, 0);
+    glUniform1i(earthDayUniform, 0);
+    glUniform1i(earthNightUniform, 1);
+
+    gpuProfiler.begin("globes");
+    for (size_t i = 0; i < packet.globes.size(); i++) {
+        const GlobeDraw& globe = packet.globes[i];
+        glUniformMatrix4fv(mvpMatrixUniform, 1, false, globe.mvp.f);
+        glUniformMatrix4fv(mvMatrixUniform, 1, false, globe.mv.f);
+
+        // render!
+        sphere.render();
+    }
+    gpuProfiler.end();
 
+    capture.capture();
     // display rendering buffer
-    SDL_GL_SwapBuffers();
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    stopUpdates();
+    program.reset();
+    earthPacked.destroy();
+    earthDay.destroy();
+    earthNight.destroy();
+    sphere.destroy();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    gpuProfiler.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-separate") == 0) {
+            packedLayers = false;
+        } else if (strcmp(argv[i], "-inline") == 0) {
+            inlineUpdate = true;
+        } else if (strcmp(argv[i], "-updates") == 0 && i + 1 < argc) {
+            updatesPerSecond = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-load") == 0 && i + 1 < argc) {
+            loadObjects = std::max(0, atoi(argv[++i]));
+        } else {
+            globeCount = std::max(1, atoi(argv[i]));
+        }
+    }
+    // the update thread runs on the wall clock, the frames of a replay are
+    // updated in step with the virtual one
+    if (replay.fixedStep()) {
+        inlineUpdate = true;
+    }
+
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        gpuProfiler.startFromEnvironment();
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_EVERYTHING);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
@@ -533,7 +669,10 @@ int main(int argc, char **argv) {
     // must be called AFTER the OpenGL context has been created
     glewInit();
     reshape(900, 900);
+    capture.startFromEnvironment(900, 900);
+    gpuProfiler.startFromEnvironment();
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -545,9 +684,16 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
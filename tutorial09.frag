@@ -1,10 +1,11 @@
 #version 330 core
 
-uniform sampler2D textureDay;
-uniform sampler2D textureNight;
+// the day and night images, bound to units 0 and 1 for every globe
+uniform samplerCube earthDay;
+uniform samplerCube earthNight;
 
 smooth in float dotProduct;
-smooth in vec2 texcoord;
+smooth in vec3 direction;
 
 out vec4 fColor;
 
@@ -12,7 +13,7 @@ void main(void)
 {
     float fDay = clamp(dotProduct + 0.9f, 0.0f, 1.0f);
     float fNight = clamp(abs(dotProduct - 0.9f), 0.0f, 1.0f);
-    vec4 texColorDay = texture2D(textureDay, texcoord);
-    vec4 texColorNight = texture2D(textureNight, texcoord);
+    vec4 texColorDay = texture(earthDay, direction);
+    vec4 texColorNight = texture(earthNight, direction);
     fColor = texColorDay * fDay + texColorNight * fNight;
 }
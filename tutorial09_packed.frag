@@ -0,0 +1,17 @@
+#version 330 core
+
+// the colors of the earth by day, and its luminance by night in alpha
+uniform samplerCube earthPacked;
+
+smooth in float dotProduct;
+smooth in vec3 direction;
+
+out vec4 fColor;
+
+void main(void) 
+{
+    float fDay = clamp(dotProduct + 0.9f, 0.0f, 1.0f);
+    float fNight = clamp(abs(dotProduct - 0.9f), 0.0f, 1.0f);
+    vec4 texColor = texture(earthPacked, direction);
+    fColor = vec4(texColor.rgb * fDay + texColor.aaa * fNight, 1.0f);
+}
@@ -1,18 +1,42 @@
-#include <sys/stat.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include <SDL/SDL.h>
-#include <SDL/SDL_image.h>
+#include <SDL/SDL_syswm.h>
 #include <GL/glew.h>
 #include <GL/glxew.h>
 #include <vector>
 #include <stack>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "gpuprofiler.h"
+#include "capture.h"
+#include "texcompress.h"
+#include "image.h"
+#include "workerpool.h"
+#include "texcache.h"
+#include "cubemap.h"
+#include "cubetexture.h"
 
 /*
  * In this tutorial, we render a rotating textured sphere which fades away and reappears.
+ * The fading follows a cloud mask, kept by default in the alpha channel of the earth
+ * texture, earth_day_cloud.png, made by the packer tool; the -separate option samples
+ * the earth and the mask from two textures instead. The images are resampled into
+ * cube maps when loaded, which the sphere samples with the direction of each fragment
+ * from its center, so it needs no texture coordinates.
  */
 
 // C/C++ does not have a default definition for pi!
@@ -22,12 +46,6 @@ inline float toRadians(float degrees) {
     return degrees * pi / 180.0f;
 }
 
-class vector2 {
-public:
-    vector2(float x, float y): x(x), y(y) {}
-    const float x, y;
-};
-
 class vector3 {
 public:
     vector3(float x, float y, float z): x(x), y(y), z(z) {}
@@ -43,10 +61,6 @@ vector3 midPoint(vector3 p1, vector3 p2) {
     return vector3((p1.x + p2.x) / 2, (p1.y + p2.y) / 2, (p1.z + p2.z) / 2);
 }
 
-inline long currentTimeMillis() {
-	return clock() / (CLOCKS_PER_SEC / 1000);
-}
-
 class matrix44 {
 public:
 	matrix44 multm(const matrix44& m2) {
@@ -177,60 +191,8 @@ public:
     std::stack<matrix44> s;
 };
 
-char* readTextFile(const char* filename) {
-    struct stat st;
-    stat(filename, &st);
-    int size = st.st_size;
-    char* content = (char*) malloc((size+1)*sizeof(char));
-    content[size] = 0;
-    // we need to read as binary, not text, otherwise we are screwed on Windows
-    FILE *file = fopen(filename, "rb");
-    fread(content, 1, size, file);
-    return content;
-}
-
 // Up to 16 attributes per vertex is allowed so any value between 0 and 15 will do.
 const int POSITION_ATTRIBUTE_INDEX = 0;
-const int TEXCOORD_ATTRIBUTE_INDEX = 1;
-
-// a class for managing a texture
-class Texture {
-
-public:
-
-    Texture(const std::string& s) {
-        imageFile = s;
-    }
-
-    void init() {
-        SDL_Surface *image = IMG_Load(imageFile.c_str());
-        if(!image) {
-            printf("IMG_Load: %s\n", IMG_GetError());
-        }
-        int width = image->w;
-        int height = image->h;
-        SDL_Surface* rgbaImage = SDL_CreateRGBSurface(0, width, height, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
-        SDL_BlitSurface(image, 0, rgbaImage, 0);
-        GLenum format = GL_RGBA;
-        
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, rgbaImage->pixels);
-    }
-
-    GLuint getId() {
-        return textureId;
-    }
-
-private:
-
-    std::string imageFile;
-    GLuint textureId;
-};
 
 // a class for calculating the vertices and drawing a sphere
 class Sphere {
@@ -238,98 +200,75 @@ class Sphere {
 public:
     
     void init() {
+        Tracer::Scope trace("Sphere::init");
         float* positions;
-        float* texcoords;
         
         int psize = sphereAttributeCount(depth)*3*sizeof(float);
-        int tsize = sphereAttributeCount(depth)*2*sizeof(float);
         
         positions = (float*) malloc(psize);
-        texcoords = (float*) malloc(tsize);
         
-        createSphereAttributes(positions, texcoords);
+        createSphereAttributes(positions);
         
-        glGenBuffers(1, &spherePositionsId);
-        glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
-        glBufferData(GL_ARRAY_BUFFER, psize, positions, GL_STATIC_DRAW);
+        // the vertex array records the attribute setup below, so that rendering
+        // only needs to bind it
+        vertexArray = gl::VertexArray::create();
+        spherePositions = gl::Buffer::create(GL_ARRAY_BUFFER, psize, positions);
+        glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
+        glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-        glGenBuffers(1, &sphereTexCoordsId);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereTexCoordsId);
-        glBufferData(GL_ARRAY_BUFFER, tsize, texcoords, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         free(positions);
-        free(texcoords);
     }
     
     void render() {
-        glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, spherePositionsId);
-        glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, sphereTexCoordsId);
-        glVertexAttribPointer(TEXCOORD_ATTRIBUTE_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);        
+        vertexArray.bind();
         glDrawArrays(GL_TRIANGLES, 0, sphereAttributeCount(depth));
-        glDisableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
-        glDisableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        vertexArray.reset();
+        spherePositions.reset();
     }
     
 private:
 
-    GLuint spherePositionsId;
-    GLuint sphereTexCoordsId;
+    gl::VertexArray vertexArray;
+    gl::Buffer spherePositions;
     
     static const int depth = 4;
 
     inline int sphereAttributeCount(int n) { return 8 * pow(4, n) * 3; }
 
-    inline vector2 cart2geog(vector3 p) { return vector2(atan2(p.y, p.x), asin(p.z)); }
-
-    void texCoord(float** t, vector3 p, triangle tr) {
-        vector2 geog = cart2geog(p);
-        vector2 geogtr = cart2geog(tr.center());
-        float lat = geog.y;
-        float lon = geog.x;
-        float t1 = lon / (2.0f*pi) + 0.5f;
-        float t2 = -1.0f * lat / pi + 0.5f;
-        if (t1 == 1.0f && geogtr.x < 0.5f) { t1 = 0.0f; }
-        if (t1 == 0.0f && geogtr.x > 0.5f) { t1 = 1.0f; }       
-        **t = t1;
-        (*t)++;
-        **t = t2;
-        (*t)++;
-    }
-
-    void refine(int d, triangle tr, float** p, float** t) {
+    void refine(int d, triangle tr, float** p) {
         if (d == depth) {
             tr.dump(p);
-            texCoord(t, tr.p1, tr);
-            texCoord(t, tr.p2, tr);
-            texCoord(t, tr.p3, tr);
         } else {
             vector3 m1 = midPoint(tr.p2, tr.p3).normalize();
             vector3 m2 = midPoint(tr.p3, tr.p1).normalize();
             vector3 m3 = midPoint(tr.p1, tr.p2).normalize();
-            refine(d + 1, triangle(tr.p1, m3, m2), p, t);
-            refine(d + 1, triangle(m3, tr.p2, m1), p, t);
-            refine(d + 1, triangle(m1, m2, m3), p, t);
-            refine(d + 1, triangle(m2, m1, tr.p3), p, t);
+            refine(d + 1, triangle(tr.p1, m3, m2), p);
+            refine(d + 1, triangle(m3, tr.p2, m1), p);
+            refine(d + 1, triangle(m1, m2, m3), p);
+            refine(d + 1, triangle(m2, m1, tr.p3), p);
         }
     }
 
-    void createSphereAttributes(float* p, float* t) {
+    void createSphereAttributes(float* p) {
         //
         // we refine each side of an octahedron
         // cf http://paulbourke.net/miscellaneous/sphere_cylinder/
         //
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &t);
-        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(1.0f, 0.0f, 0.0f)), &p);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p);
     }
 
 };
@@ -343,67 +282,50 @@ const float nearPlane = 2.0f;
 const float farPlane = 10.0f;
 
 bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
 long startTimeMillis;
-GLuint programId;
-Texture textureEarth("earth_day.jpg");
-Texture textureCloud("cloud.jpg");
+gl::Program program;
+// the earth colors and the cloud mask in one RGBA texture, one fetch per fragment
+CubeTexture textureEarthCloud("earth_day_cloud.png", BLOCK_BC3);
+// or two textures, two fetches; the cloud mask is only read through its red
+// channel, which BC4 keeps
+CubeTexture textureEarth("earth_day.jpg", BLOCK_BC1);
+CubeTexture textureCloud("cloud.jpg", BLOCK_BC4);
+// false with the -separate option
+bool packedLayers = true;
 Sphere sphere;
 
 float aspectRatio;
-int frameCount;
+// times the frames, see frameclock.h
+FrameClock frameClock;
+// times the passes when CGLCORE_GPU_PROFILE is set, see gpuprofiler.h
+GpuProfiler gpuProfiler;
 int totalFrameCount;
 int currentWidth;
 int currentHeight;
 
-void checkShaderCompileStatus(GLuint shaderId) {
-    GLint compileStatus;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileStatus);
-    if (compileStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Shader compilation failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetShaderInfoLog(shaderId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
-void checkProgramLinkStatus(GLuint programId) {
-    GLint linkStatus;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (linkStatus == GL_FALSE) {
-        GLint infoLogLength;
-        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLogLength);
-        printf("Program link failed...\n");
-        char* log = (char*) malloc((1+infoLogLength)*sizeof(char));
-        glGetProgramInfoLog(programId, infoLogLength, NULL, log);
-        log[infoLogLength] = 0;
-        printf("%s", log);
-    }
-}
-
 void createProgram() {
-    const GLchar* vertexShaderSource = readTextFile("tutorial10.vert");
-    int vertexShaderSourceLength = strlen(vertexShaderSource);
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShaderId, 1, &vertexShaderSource, &vertexShaderSourceLength);
-    glCompileShader(vertexShaderId);
-	checkShaderCompileStatus(vertexShaderId);
-
-    const GLchar* fragmentShaderSource = readTextFile("tutorial10.frag");
-    int fragmentShaderSourceLength = strlen(fragmentShaderSource);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, &fragmentShaderSourceLength);
-    glCompileShader(fragmentShaderId);
-	checkShaderCompileStatus(fragmentShaderId);
-
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
-    glBindAttribLocation(programId, POSITION_ATTRIBUTE_INDEX, "vPosition");
-    glLinkProgram(programId);
-    checkProgramLinkStatus(programId);
+    Tracer::Scope trace("createProgram");
+    AssetData vertexShaderSource("tutorial10.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource(packedLayers ? "tutorial10_packed.frag" : "tutorial10.frag");
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    program = gl::Program::create();
+    program.attach(vertexShader);
+    program.attach(fragmentShader);
+    program.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    program.link();
 }
 
 void reshape(int width, int height) {
@@ -417,37 +339,54 @@ void reshape(int width, int height) {
 // thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
 void timer(int value) {
     char title[512];
-    sprintf(title, "Tutorial10: %d FPS @ %d x %d", frameCount * 4, currentWidth, currentHeight);
+    sprintf(title, "Tutorial10: %.0f FPS (%s) @ %d x %d, %s layers, %d texture binds per frame",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight, packedLayers ? "packed" : "separate", CubeTexture::binds());
     SDL_WM_SetCaption(title, title);
-    frameCount = 0;
 }
 
 void render() {
+    Tracer::Scope trace("render");
 
     if (initialized == false) {
+        Tracer::Scope trace("init");
         glEnable(GL_TEXTURE_2D);    
         glEnable(GL_CULL_FACE);
         glEnable(GL_DEPTH_TEST);
-        sphere.init();
-        textureEarth.init();
-        textureCloud.init();
-        createProgram();
-        startTimeMillis = currentTimeMillis();
+        // filters across the edges of the cube faces
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+        {
+            // the images are decoded in parallel while the sphere and the program are set up
+            WorkerPool pool;
+            if (packedLayers) {
+                textureEarthCloud.load(pool);
+            } else {
+                textureEarth.load(pool);
+                textureCloud.load(pool);
+            }
+            sphere.init();
+            createProgram();
+            CubeTexture* textures[] = { &textureEarthCloud, &textureEarth, &textureCloud };
+            uploadWhenReady(textures, 3);
+        }
+        startTimeMillis = replay.now();
         initialized = true;
     }
 
-    frameCount++;
+    frameClock.beginFrame();
+    gpuProfiler.beginFrame();
     totalFrameCount++;
     long now = currentTimeMillis();
-    long elapsed = now - startTimeMillis;
+    long elapsed = replay.now() - startTimeMillis;
     static long lastTimerCall = 0;
     if ((now - lastTimerCall) > 250) {
         timer(0);
         lastTimerCall = now;
     }
 
+    gpuProfiler.begin("clear");
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(programId);
+    gpuProfiler.end();
+    program.use();
 
     //
     // calculate the ModelViewProjection and ModelViewProjection matrices
@@ -467,30 +406,96 @@ void render() {
     mvp.push(rotateMat3);
 
     // activate the textures
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureEarth.getId());
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, textureCloud.getId());
+    CubeTexture::binds() = 0;
+    if (packedLayers) {
+        textureEarthCloud.bind(0);
+    } else {
+        textureEarth.bind(0);
+        textureCloud.bind(1);
+    }
     
     // set the uniforms before rendering
-    GLuint mvpMatrixUniform = glGetUniformLocation(programId, "mvpMatrix");
-    GLuint textureEarthUniform = glGetUniformLocation(programId, "textureEarth");
-    GLuint textureCloudUniform = glGetUniformLocation(programId, "textureCloud");
-    GLuint thresholdUniform = glGetUniformLocation(programId, "threshold");
+    GLuint mvpMatrixUniform = glGetUniformLocation(program.getId(), "mvpMatrix");
+    GLuint textureEarthCloudUniform = glGetUniformLocation(program.getId(), "textureEarthCloud");
+    GLuint textureEarthUniform = glGetUniformLocation(program.getId(), "textureEarth");
+    GLuint textureCloudUniform = glGetUniformLocation(program.getId(), "textureCloud");
+    GLuint thresholdUniform = glGetUniformLocation(program.getId(), "threshold");
     glUniformMatrix4fv(mvpMatrixUniform, 1, false, mvp.top().f);
     glUniform1f(thresholdUniform, sin(0.001*elapsed)/2 + 0.5);
+    glUniform1i(textureEarthCloudUniform, 0);
     glUniform1i(textureEarthUniform, 0);
     glUniform1i(textureCloudUniform, 1);
 
     // render!
+    gpuProfiler.begin("sphere");
     sphere.render();
+    gpuProfiler.end();
 
+    capture.capture();
     // display rendering buffer
-    SDL_GL_SwapBuffers();
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    textureEarthCloud.destroy();
+    textureEarth.destroy();
+    textureCloud.destroy();
+    sphere.destroy();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    gpuProfiler.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
 }
 
 int main(int argc, char **argv) {
 
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "-separate") == 0) {
+        packedLayers = false;
+    }
+
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        gpuProfiler.startFromEnvironment();
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_EVERYTHING);
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
@@ -506,7 +511,10 @@ int main(int argc, char **argv) {
     // must be called AFTER the OpenGL context has been created
     glewInit();
     reshape(900, 900);
+    capture.startFromEnvironment(900, 900);
+    gpuProfiler.startFromEnvironment();
 
+    frameLoop.start(sdlDisplayFd());
     SDL_Event event;
     bool done = false;
     while (!done) {
@@ -518,9 +526,16 @@ int main(int argc, char **argv) {
                 done = true;
             }
         }
-        render();
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
     }
 
+    destroy();
     SDL_FreeSurface(surfDisplay);
     SDL_Quit();
     return 0;
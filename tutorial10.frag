@@ -1,21 +1,21 @@
 #version 330 core
 
-uniform sampler2D textureEarth;
-uniform sampler2D textureCloud;
+uniform samplerCube textureEarth;
+uniform samplerCube textureCloud;
 uniform float threshold;
 
-smooth in vec2 texcoord;
+smooth in vec3 direction;
 
 out vec4 fColor;
 
 void main(void) 
 {
-    vec4 texColorCloud = texture2D(textureCloud, texcoord);
+    vec4 texColorCloud = texture(textureCloud, direction);
     if (texColorCloud.r < threshold) {
         discard;
     }
         
-    vec4 texColorEarth = texture2D(textureEarth, texcoord);
+    vec4 texColorEarth = texture(textureEarth, direction);
     fColor = texColorEarth;
 }
 
@@ -1,17 +1,17 @@
 #version 330 core
 
 uniform mat4 mvpMatrix;
-uniform sampler2D textureEarth;
-uniform sampler2D textureCloud;
+uniform samplerCube textureEarth;
+uniform samplerCube textureCloud;
 uniform float threshold;
 
 in vec3 vPosition;
-in vec2 vTexCoord;
 
-smooth out vec2 texcoord;
+smooth out vec3 direction;
 
 void main(void) 
 {
-    texcoord = vTexCoord;
+    // the cube maps are sampled with the direction from the center of the sphere
+    direction = vPosition;
     gl_Position = mvpMatrix * vec4(vPosition, 1.0f);
 }
@@ -0,0 +1,18 @@
+#version 330 core
+
+// the colors of the earth, and the cloud mask in alpha
+uniform samplerCube textureEarthCloud;
+uniform float threshold;
+
+smooth in vec3 direction;
+
+out vec4 fColor;
+
+void main(void) 
+{
+    vec4 texColor = texture(textureEarthCloud, direction);
+    if (texColor.a < threshold) {
+        discard;
+    }
+    fColor = vec4(texColor.rgb, 1.0f);
+}
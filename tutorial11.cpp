@@ -0,0 +1,588 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_syswm.h>
+#include <GL/glew.h>
+#include <GL/glxew.h>
+#include <vector>
+#include <stack>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include "assets.h"
+#include "globjects.h"
+#include "headless.h"
+#include "tracer.h"
+#include "frameloop.h"
+#include "inflight.h"
+#include "replay.h"
+#include "frameclock.h"
+#include "gpuprofiler.h"
+#include "capture.h"
+#include "virtualtexture.h"
+
+/*
+ * In this tutorial, we render a rotating sphere textured with an image far too large for the GPU,
+ * streamed tile by tile as the camera zooms in with the up and down arrows, see virtualtexture.h.
+ */
+
+// C/C++ does not have a default definition for pi!
+const float pi = atan(1.0f) * 4.0f;
+
+inline float toRadians(float degrees) {
+    return degrees * pi / 180.0f;
+}
+
+class vector2 {
+public:
+    vector2(float x, float y): x(x), y(y) {}
+    const float x, y;
+};
+
+class vector3 {
+public:
+    vector3(float x, float y, float z): x(x), y(y), z(z) {}
+    void dump(float** p) { (*p)[0] = x; (*p)[1] = y; (*p)[2] = z; *p += 3; }
+    vector3 normalize() {
+        float norm = sqrt(x*x + y*y + z*z);
+        return vector3(x / norm, y / norm, z / norm);
+    }
+    const float x, y, z;
+};
+
+vector3 midPoint(vector3 p1, vector3 p2) {
+    return vector3((p1.x + p2.x) / 2, (p1.y + p2.y) / 2, (p1.z + p2.z) / 2);
+}
+
+class matrix44 {
+public:
+	matrix44 multm(const matrix44& m2) {
+		matrix44 m;
+		for (int i = 0; i < 4; i++) {
+		    for (int j = 0; j < 4; j++) {
+		        m.f[i+j*4] =
+		            f[i+0] * m2.f[j*4+0] +
+		            f[i+4] * m2.f[j*4+1] +
+		            f[i+8] * m2.f[j*4+2] +
+		            f[i+12] * m2.f[j*4+3];
+		    }
+		}
+		return m;
+	}
+	float f[16];
+};
+
+class triangle {
+public:
+    triangle(vector3 p1, vector3 p2, vector3 p3): p1(p1), p2(p2), p3(p3) {}
+    void dump(float** p) { p1.dump(p); p2.dump(p); p3.dump(p); }
+    vector3 center() { return vector3((p1.x+p2.x+p3.x)/3, (p1.y+p2.y+p3.y)/3, (p1.z+p2.z+p3.z)/3); }
+    vector3 p1, p2, p3;
+};
+
+matrix44 identity() {
+    matrix44 identityMatrix;
+    float* mi = identityMatrix.f;
+    mi[0] = 1.0f;
+    mi[1] = 0.0f;
+    mi[2] = 0.0f;
+    mi[3] = 0.0f;
+    mi[4] = 0.0f;
+    mi[5] = 1.0f;
+    mi[6] = 0.0f;
+    mi[7] = 0.0f;
+    mi[8] = 0.0f;
+    mi[9] = 0.0f;
+    mi[10] = 1.0;
+    mi[11] = 0.0f;
+    mi[12] = 0.0f;
+    mi[13] = 0.0f;
+    mi[14] = 0.0;
+    mi[15] = 1.0f;
+    return identityMatrix;
+}
+
+matrix44 frustum(float left, float right, float bottom, float top, float near, float far) {
+    matrix44 frustumMatrix;
+    float* m = frustumMatrix.f;
+    m[0] = 2 * near / (right - left);
+    m[1] = 0.0f;
+    m[2] = 0.0f;
+    m[3] = 0.0f;
+    m[4] = 0.0f;
+    m[5] = 2 * near / (top - bottom);
+    m[6] = 0.0f;
+    m[7] = 0.0f;
+    m[8] = (right + left) / (right - left);
+    m[9] = (top + bottom) / (top - bottom);
+    m[10] = - (far + near) / (far - near);
+    m[11] = -1.0f;
+    m[12] = 0.0f;
+    m[13] = 0.0f;
+    m[14] = -2.0f * far * near / (far - near);
+    m[15] = 0.0f;
+    return frustumMatrix;
+}
+
+matrix44 translate(float x, float y, float z) {
+	matrix44 translateMatrix;
+	float* m = translateMatrix.f;
+    m[0] = 1.0f;
+    m[1] = 0.0f;
+    m[2] = 0.0f;
+    m[3] = 0.0f;
+    m[4] = 0.0f;
+    m[5] = 1.0f;
+    m[6] = 0.0f;
+    m[7] = 0.0f;
+    m[8] = 0.0f;
+    m[9] = 0.0f;
+    m[10] = 1.0f;
+    m[11] = 0.0f;
+    m[12] = x;
+    m[13] = y;
+    m[14] = z;
+    m[15] = 1.0f;
+	return translateMatrix;
+}
+
+matrix44 rotate(float a, float x, float y, float z) {
+	matrix44 rotateMatrix;
+	float* m = rotateMatrix.f;
+    float c = (float) cos(toRadians(a));
+    float s = (float) sin(toRadians(a));
+    m[0] = x * x * (1 - c) + c;
+    m[1] = y * x * (1 - c) + z * s;
+    m[2] = x * z * (1 - c) - y * s;
+    m[3] = 0.0f;
+    m[4] = y * x * (1 - c) - z * s;
+    m[5] = y * y * (1 - c) + c;
+    m[6] = y * z * (1 - c) + x * s;
+    m[7] = 0.0f;
+    m[8] = x * z * (1 - c) + y * s;
+    m[9] = y * z * (1 - c) - x * s;
+    m[10] = z * z * (1 - c) + c;
+    m[11] = 0.0f;
+    m[12] = 0.0f;
+    m[13] = 0.0f;
+    m[14] = 0.0f;
+    m[15] = 1.0f;
+	return rotateMatrix;
+}
+
+class mstack {
+public:
+    mstack() {
+        s.push(identity());
+    }
+    void push(matrix44 m) {
+        s.push(s.top().multm(m));
+    }
+    matrix44 top() {
+        return s.top();
+    }
+    std::stack<matrix44> s;
+};
+
+// Up to 16 attributes per vertex is allowed so any value between 0 and 15 will do.
+const int POSITION_ATTRIBUTE_INDEX = 0;
+const int TEXCOORD_ATTRIBUTE_INDEX = 1;
+
+// a class for calculating the vertices and drawing a sphere
+class Sphere {
+
+public:
+    
+    void init() {
+        Tracer::Scope trace("Sphere::init");
+        float* positions;
+        float* texcoords;
+        
+        int psize = sphereAttributeCount(depth)*3*sizeof(float);
+        int tsize = sphereAttributeCount(depth)*2*sizeof(float);
+        
+        positions = (float*) malloc(psize);
+        texcoords = (float*) malloc(tsize);
+        
+        createSphereAttributes(positions, texcoords);
+        
+        // the vertex array records the attribute setup below, so that rendering
+        // only needs to bind it
+        vertexArray = gl::VertexArray::create();
+        spherePositions = gl::Buffer::create(GL_ARRAY_BUFFER, psize, positions);
+        glEnableVertexAttribArray(POSITION_ATTRIBUTE_INDEX);
+        glVertexAttribPointer(POSITION_ATTRIBUTE_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+        sphereTexCoords = gl::Buffer::create(GL_ARRAY_BUFFER, tsize, texcoords);
+        glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE_INDEX);
+        glVertexAttribPointer(TEXCOORD_ATTRIBUTE_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        free(positions);
+        free(texcoords);
+    }
+    
+    void render() {
+        vertexArray.bind();
+        glDrawArrays(GL_TRIANGLES, 0, sphereAttributeCount(depth));
+        glBindVertexArray(0);
+    }
+
+    void destroy() {
+        vertexArray.reset();
+        spherePositions.reset();
+        sphereTexCoords.reset();
+    }
+    
+private:
+
+    gl::VertexArray vertexArray;
+    gl::Buffer spherePositions;
+    gl::Buffer sphereTexCoords;
+    
+    // finer than in the other tutorials, the sphere is seen from up close
+    static const int depth = 6;
+
+    inline int sphereAttributeCount(int n) { return 8 * pow(4, n) * 3; }
+
+    inline vector2 cart2geog(vector3 p) { return vector2(atan2(p.y, p.x), asin(p.z)); }
+
+    void texCoord(float** t, vector3 p, triangle tr) {
+        vector2 geog = cart2geog(p);
+        vector2 geogtr = cart2geog(tr.center());
+        float lat = geog.y;
+        float lon = geog.x;
+        float t1 = lon / (2.0f*pi) + 0.5f;
+        float t2 = -1.0f * lat / pi + 0.5f;
+        if (t1 == 1.0f && geogtr.x < 0.5f) { t1 = 0.0f; }
+        if (t1 == 0.0f && geogtr.x > 0.5f) { t1 = 1.0f; }       
+        **t = t1;
+        (*t)++;
+        **t = t2;
+        (*t)++;
+    }
+
+    void refine(int d, triangle tr, float** p, float** t) {
+        if (d == depth) {
+            tr.dump(p);
+            texCoord(t, tr.p1, tr);
+            texCoord(t, tr.p2, tr);
+            texCoord(t, tr.p3, tr);
+        } else {
+            vector3 m1 = midPoint(tr.p2, tr.p3).normalize();
+            vector3 m2 = midPoint(tr.p3, tr.p1).normalize();
+            vector3 m3 = midPoint(tr.p1, tr.p2).normalize();
+            refine(d + 1, triangle(tr.p1, m3, m2), p, t);
+            refine(d + 1, triangle(m3, tr.p2, m1), p, t);
+            refine(d + 1, triangle(m1, m2, m3), p, t);
+            refine(d + 1, triangle(m2, m1, tr.p3), p, t);
+        }
+    }
+
+    void createSphereAttributes(float* p, float* t) {
+        //
+        // we refine each side of an octahedron
+        // cf http://paulbourke.net/miscellaneous/sphere_cylinder/
+        //
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, 1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, 1.0f), vector3(-1.0f, 0.0f, 0.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(-1.0f, 0.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f)), &p, &t);
+        refine(0, triangle(vector3(0.0f, -1.0f, 0.0f), vector3(0.0f, 0.0f, -1.0f), vector3(1.0f, 0.0f, 0.0f)), &p, &t);
+    }
+
+};
+
+// defines the perspective projection volume: the near plane moves with the
+// camera, always at the same ratio of its width to its distance
+const float fieldOfView = 0.5f;
+
+bool initialized = false;
+// records the frames when CGLCORE_CAPTURE is set, see capture.h
+FrameCapture capture;
+// renders without a window with -headless, see headless.h
+Headless headless;
+// paces the frames at -fps N, 60 by default, see frameloop.h
+FrameLoop frameLoop;
+// bounds the frames queued for the GPU to -inflight N, 2 by default, see inflight.h
+FramesInFlight framesInFlight;
+// the virtual clock and the recorded input of -step, -record and -replay, see replay.h
+Replay replay;
+long startTimeMillis;
+gl::Program program;
+gl::Program feedbackProgram;
+VirtualTexture virtualTexture;
+std::string tileStorePath = "earth_day.tiles";
+Sphere sphere;
+
+// from the center of the earth, in earth radii
+float cameraDistance = 3.0f;
+float aspectRatio;
+// times the frames, see frameclock.h
+FrameClock frameClock;
+// times the passes when CGLCORE_GPU_PROFILE is set, see gpuprofiler.h
+GpuProfiler gpuProfiler;
+int totalFrameCount;
+int currentWidth;
+int currentHeight;
+
+gl::Program createProgram(const char* fragmentShaderFile) {
+    AssetData vertexShaderSource("tutorial11.vert");
+    gl::Shader vertexShader = gl::Shader::create(GL_VERTEX_SHADER, vertexShaderSource.text(), vertexShaderSource.size());
+
+    AssetData fragmentShaderSource(fragmentShaderFile);
+    gl::Shader fragmentShader = gl::Shader::create(GL_FRAGMENT_SHADER, fragmentShaderSource.text(), fragmentShaderSource.size());
+
+    gl::Program created = gl::Program::create();
+    created.attach(vertexShader);
+    created.attach(fragmentShader);
+    created.bindAttribLocation(POSITION_ATTRIBUTE_INDEX, "vPosition");
+    created.bindAttribLocation(TEXCOORD_ATTRIBUTE_INDEX, "vTexCoord");
+    created.link();
+    return created;
+}
+
+void reshape(int width, int height) {
+    glViewport(0, 0, width, height);
+    // we keep track of the aspect ratio to adjust the projection volume
+    aspectRatio = 1.0f * width / height;
+    currentWidth = width;
+    currentHeight = height;
+}
+
+// moves the camera closer, or further away, by a tenth of its altitude
+void zoom(int direction) {
+    float altitude = cameraDistance - 1.0f;
+    cameraDistance = 1.0f + std::max(0.0005f, std::min(2.0f, altitude * (direction > 0 ? 0.9f : 1.0f / 0.9f)));
+}
+
+// the arrows zoom, escape returns false to quit
+bool keyDown(int key) {
+    if (key == SDLK_UP) {
+        zoom(1);
+    } else if (key == SDLK_DOWN) {
+        zoom(-1);
+    } else if (key == SDLK_ESCAPE) {
+        return false;
+    }
+    return true;
+}
+
+// applies the keys recorded before the frame to render, see replay.h
+void replayEvents() {
+    ReplayEvent event;
+    while (replay.poll(event)) {
+        if (event.type == ReplayEvent::KEY_DOWN) {
+            keyDown(event.x);
+        }
+    }
+}
+
+// thanks to http://openglbook.com/the-book/chapter-1-getting-started/#toc-measuring-performance
+void timer(int value) {
+    char title[512];
+    sprintf(title, "Tutorial11: %.0f FPS (%s) @ %d x %d, %d/%d pages, %d loading, %ld uploads, %ld evictions, %.1f MB",
+        frameClock.getFramesPerSecond(), frameClock.summary().c_str(), currentWidth, currentHeight, virtualTexture.getResidentPages(), virtualTexture.getPageCount(),
+        virtualTexture.getLoadsInFlight(), virtualTexture.getUploads(), virtualTexture.getEvictions(),
+        virtualTexture.getMemoryUsed() / 1048576.0);
+    SDL_WM_SetCaption(title, title);
+}
+
+void drawSphere(const gl::Program& pass, const matrix44& mvpMatrix, bool feedback) {
+    pass.use();
+    glUniformMatrix4fv(glGetUniformLocation(pass.getId(), "mvpMatrix"), 1, false, mvpMatrix.f);
+    glUniform1i(glGetUniformLocation(pass.getId(), "atlas"), 0);
+    glUniform1i(glGetUniformLocation(pass.getId(), "indirection"), 1);
+    virtualTexture.setUniforms(pass.getId(), feedback);
+    sphere.render();
+}
+
+void render() {
+    Tracer::Scope trace("render");
+
+    if (initialized == false) {
+        Tracer::Scope trace("init");
+        glEnable(GL_CULL_FACE);
+        glEnable(GL_DEPTH_TEST);
+        if (!virtualTexture.init(tileStorePath)) {
+            printf("Build %s with: tiler image %s\n", tileStorePath.c_str(), tileStorePath.c_str());
+            exit(1);
+        }
+        sphere.init();
+        program = createProgram("tutorial11.frag");
+        feedbackProgram = createProgram("tutorial11_feedback.frag");
+        startTimeMillis = replay.now();
+        initialized = true;
+    }
+
+    replayEvents();
+    frameClock.beginFrame();
+    gpuProfiler.beginFrame();
+    totalFrameCount++;
+    long now = currentTimeMillis();
+    long elapsed = replay.now() - startTimeMillis;
+    static long lastTimerCall = 0;
+    if ((now - lastTimerCall) > 250) {
+        timer(0);
+        lastTimerCall = now;
+    }
+
+    // requests the tiles the previous frame was missing, and uploads those
+    // that arrived
+    gpuProfiler.begin("tile uploads");
+    virtualTexture.update();
+    gpuProfiler.end();
+
+    //
+    // calculate the ModelViewProjection matrix
+    //
+    mstack mvp;
+
+    float nearPlane = (cameraDistance - 1.0f) * 0.5f;
+    float farPlane = cameraDistance + 1.0f;
+    float halfWidth = nearPlane * fieldOfView;
+    matrix44 frustumMat = frustum(-halfWidth, halfWidth, -halfWidth / aspectRatio, halfWidth / aspectRatio, nearPlane, farPlane);
+    matrix44 translateMat = translate(0.0f, 0.0f, -cameraDistance);
+    matrix44 rotateMat1 = rotate(-90, 1.0f, 0.0f, 0.0f);
+    matrix44 rotateMat2 = rotate(-90, 0.0f, 0.0f, 1.0f);
+    // slower as the camera gets closer, so that the ground moves at the same pace on screen
+    matrix44 rotateMat3 = rotate(1.0f * elapsed / 50 * std::min(1.0f, cameraDistance - 1.0f), 0.0f, 0.0f, 1.0f);
+
+    mvp.push(frustumMat);
+    mvp.push(translateMat);
+    mvp.push(rotateMat1);
+    mvp.push(rotateMat2);
+    mvp.push(rotateMat3);
+
+    virtualTexture.bind(0, 1);
+
+    // the feedback pass tells the virtual texture which tiles this frame needs
+    gpuProfiler.begin("feedback");
+    virtualTexture.beginFeedback(currentWidth, currentHeight);
+    drawSphere(feedbackProgram, mvp.top(), true);
+    virtualTexture.endFeedback(currentWidth, currentHeight);
+    gpuProfiler.end();
+
+    gpuProfiler.begin("sphere");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawSphere(program, mvp.top(), false);
+    gpuProfiler.end();
+
+    capture.capture();
+    // display rendering buffer
+    frameClock.beginSwap();
+    {
+        Tracer::Scope trace("swap");
+        if (headless.active()) {
+            headless.swap();
+        } else {
+            SDL_GL_SwapBuffers();
+        }
+    }
+    framesInFlight.throttle();
+    frameClock.endFrame();
+    replay.endFrame();
+}
+
+// releases the GL objects of the scene, the context must still be current; the next
+// frame builds the scene again
+void releaseScene() {
+    program.reset();
+    feedbackProgram.reset();
+    virtualTexture.destroy();
+    sphere.destroy();
+    initialized = false;
+}
+
+// ends the session, once: releases the scene and finishes what ran across
+// its frames
+void destroy() {
+    capture.finish();
+    gpuProfiler.finish();
+    releaseScene();
+    framesInFlight.finish();
+    replay.finish();
+    Tracer::instance().finish();
+}
+
+int main(int argc, char **argv) {
+
+    headless.parseArguments(argc, argv);
+    frameLoop.parseArguments(argc, argv);
+    framesInFlight.parseArguments(argc, argv);
+    replay.parseArguments(argc, argv);
+    Tracer::instance().startFromEnvironment();
+    if (!replay.start()) {
+        return 1;
+    }
+    if (argc > 1) {
+        tileStorePath = argv[1];
+    }
+
+    if (headless.active()) {
+        if (!headless.create()) {
+            return 1;
+        }
+        reshape(headless.getWidth(), headless.getHeight());
+        capture.startFromEnvironment(headless.getWidth(), headless.getHeight());
+        gpuProfiler.startFromEnvironment();
+        headless.run(render, releaseScene);
+        destroy();
+        headless.destroy();
+        return 0;
+    }
+
+    SDL_Init(SDL_INIT_EVERYTHING);
+    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
+    SDL_GL_SetAttribute(SDL_GL_BUFFER_SIZE, 32);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS,  1);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES,  2);
+    SDL_Surface* surfDisplay = SDL_SetVideoMode(900, 900, 32,
+            SDL_HWSURFACE | SDL_GL_DOUBLEBUFFER | SDL_OPENGL);
+
+    // must be called AFTER the OpenGL context has been created
+    glewInit();
+    reshape(900, 900);
+    capture.startFromEnvironment(900, 900);
+    gpuProfiler.startFromEnvironment();
+
+    frameLoop.start(sdlDisplayFd());
+    SDL_Event event;
+    bool done = false;
+    while (!done) {
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                done = true;
+            } else if (event.type == SDL_KEYDOWN && !replay.replaying()) {
+                // while replaying, the keys come from the recording
+                replay.record(ReplayEvent::KEY_DOWN, event.key.keysym.sym);
+                if (!keyDown(event.key.keysym.sym)) {
+                    done = true;
+                }
+            }
+        }
+        if (replay.ended()) {
+            // the recorded session is over, see replay.h
+            break;
+        }
+        if (frameLoop.wait()) {
+            render();
+        }
+    }
+
+    destroy();
+    SDL_FreeSurface(surfDisplay);
+    SDL_Quit();
+    return 0;
+}
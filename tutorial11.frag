@@ -0,0 +1,32 @@
+#version 330 core
+
+uniform sampler2D atlas;
+uniform usampler2D indirection;
+uniform vec2 virtualSize;
+uniform vec2 imageScale;
+uniform float tileSize;
+uniform float border;
+uniform float atlasSize;
+uniform float maxLevel;
+uniform float lodBias;
+
+smooth in vec2 texcoord;
+
+out vec4 fColor;
+
+void main(void) 
+{
+    // the level a mip mapped texture of the whole image would sample
+    vec2 texel = texcoord * imageScale * virtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + lodBias, 0.0, maxLevel);
+    int level = int(lod);
+
+    // the page holding the tile, or its closest ancestor in memory
+    ivec2 tile = min(ivec2(texel / (tileSize * exp2(level))), textureSize(indirection, level) - 1);
+    uvec4 entry = texelFetch(indirection, tile, level);
+    vec2 inTile = fract(texel / (tileSize * exp2(float(entry.b)))) * tileSize;
+    vec2 atlasTexel = vec2(entry.rg) * (tileSize + 2.0 * border) + border + inTile;
+    fColor = texture(atlas, atlasTexel / atlasSize);
+}
@@ -0,0 +1,14 @@
+#version 330 core
+
+uniform mat4 mvpMatrix;
+
+in vec3 vPosition;
+in vec2 vTexCoord;
+
+smooth out vec2 texcoord;
+
+void main(void) 
+{
+    texcoord = vTexCoord;
+    gl_Position = mvpMatrix * vec4(vPosition, 1.0f);
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+uniform vec2 virtualSize;
+uniform vec2 imageScale;
+uniform float tileSize;
+uniform float maxLevel;
+uniform float lodBias;
+
+smooth in vec2 texcoord;
+
+out uvec4 fFeedback;
+
+void main(void) 
+{
+    // the same level as tutorial11.frag; lodBias makes up for the lower
+    // resolution of this pass
+    vec2 texel = texcoord * imageScale * virtualSize;
+    vec2 dx = dFdx(texel);
+    vec2 dy = dFdy(texel);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + lodBias, 0.0, maxLevel);
+    int level = int(lod);
+
+    // the tile this pixel wants, whether it is in memory or not
+    ivec2 tile = min(ivec2(texel / (tileSize * exp2(level))), ivec2(virtualSize / tileSize) / (1 << level) - 1);
+    fFeedback = uvec4(max(tile, ivec2(0)), level, 1);
+}
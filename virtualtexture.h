@@ -0,0 +1,462 @@
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <unordered_map>
+#include "globjects.h"
+#include "image.h"
+#include "workerpool.h"
+#include "tilestore.h"
+
+/*
+ * Virtual texturing, for images much larger than GPU memory, or than main
+ * memory for that matter.
+ *
+ * The tiler tool cuts the image offline into a pyramid of tiles, see
+ * tilestore.h.
+ *
+ * At runtime only the tiles the screen needs live on the GPU, in the pages of
+ * a fixed size atlas texture:
+ * - a feedback pass renders the scene at low resolution, writing for each
+ *   pixel the tile and the level it samples, and reads it back into one of
+ *   two pixel buffers in turn, each mapped two frames later so that mapping
+ *   never waits for the GPU;
+ * - missing tiles are read and decoded by a worker pool, then copied into a
+ *   free page, or into the page that was least recently used;
+ * - an indirection texture, with one texel per tile and one mip level per
+ *   level of the pyramid, maps each tile to its page. A tile that is not in
+ *   memory maps to the page of its closest ancestor that is, so the image is
+ *   always complete, blurry at worst.
+ * The GPU memory used is the atlas plus the indirection texture, whatever the
+ * size of the image.
+ */
+
+class VirtualTexture {
+
+public:
+
+    // atlasPages x atlasPages tiles are kept on the GPU; feedbackScale is the
+    // ratio between the screen and the feedback pass resolutions
+    VirtualTexture(int atlasPages = 16, int feedbackScale = 8) : atlasPages(atlasPages), feedbackScale(feedbackScale),
+        feedbackFramebuffer(0), previousFramebuffer(0), feedbackWidth(0), feedbackHeight(0), feedbackPasses(0), currentBuffer(0), frame(0),
+        indirectionDirty(false), uploads(0), evictions(0) {}
+
+    // opens the tile store and creates the GL objects; the coarsest level is
+    // loaded right away and never evicted, it is what is shown until the
+    // finer tiles arrive
+    bool init(const std::string& storePath) {
+        Tracer::Scope trace("VirtualTexture::init");
+        store.reset(new TileStore());
+        if (!store->open(storePath)) {
+            store.reset();
+            return false;
+        }
+        const TileStoreHeader& header = store->getHeader();
+        pool.reset(new WorkerPool());
+
+        int atlasSize = atlasPages * store->getPageSize();
+        atlas = gl::Texture::create(GL_TEXTURE_2D);
+        atlas.storage2D(1, GL_RGBA8, atlasSize, atlasSize);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        pages.resize(atlasPages * atlasPages);
+
+        // integer texels, fetched without filtering: x and y of the page, the
+        // level of the tile in it, and 255 once an entry is valid
+        indirection = gl::Texture::create(GL_TEXTURE_2D);
+        indirection.storage2D(store->getLevels(), GL_RGBA8UI, header.tilesX, header.tilesY);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        indirectionLevels.resize(store->getLevels());
+        for (int level = 0; level < store->getLevels(); level++) {
+            indirectionLevels[level].resize((size_t) store->getTilesX(level) * store->getTilesY(level) * 4);
+        }
+
+        int coarsest = store->getLevels() - 1;
+        for (int y = 0; y < store->getTilesY(coarsest); y++) {
+            for (int x = 0; x < store->getTilesX(coarsest); x++) {
+                std::vector<unsigned char> pixels;
+                if (!store->hasTile(coarsest, x, y) || !loadTile(coarsest, x, y, pixels)) {
+                    printf("Could not load the coarsest level of %s\n", storePath.c_str());
+                    return false;
+                }
+                int page = allocatePage();
+                uploadTile(page, tileKey(coarsest, x, y), pixels);
+                pages[page].pinned = true;
+            }
+        }
+        buildIndirection();
+        return true;
+    }
+
+    // consumes the feedback of the previous frame and the tiles the workers
+    // decoded since, then brings the indirection texture up to date
+    void update() {
+        Tracer::Scope trace("virtual texture update");
+        frame++;
+        processFeedback();
+        completeLoads();
+        if (indirectionDirty) {
+            buildIndirection();
+        }
+    }
+
+    // redirects rendering to the feedback framebuffer, sized after the viewport
+    void beginFeedback(int viewportWidth, int viewportHeight) {
+        int width = std::max(1, viewportWidth / feedbackScale);
+        int height = std::max(1, viewportHeight / feedbackScale);
+        // the scene may not render to the default framebuffer, see headless.h
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        if (width != feedbackWidth || height != feedbackHeight) {
+            createFeedbackTargets(width, height);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        GLuint clear[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 0, clear);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // starts reading the feedback back into a pixel buffer, without waiting
+    // for it: update() maps the other buffer, read back a frame earlier, and
+    // gets to this one on the frame after next, when it is long done
+    void endFeedback(int viewportWidth, int viewportHeight) {
+        currentBuffer = 1 - currentBuffer;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[currentBuffer].getId());
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+        feedbackPasses++;
+    }
+
+    void bind(int atlasUnit, int indirectionUnit) {
+        glActiveTexture(GL_TEXTURE0 + atlasUnit);
+        atlas.bind();
+        glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+        indirection.bind();
+    }
+
+    // sets the uniforms shared by the render and the feedback shaders
+    void setUniforms(GLuint programId, bool feedback) {
+        const TileStoreHeader& header = store->getHeader();
+        float virtualWidth = (float) header.tilesX * header.tileSize;
+        float virtualHeight = (float) header.tilesY * header.tileSize;
+        glUniform2f(glGetUniformLocation(programId, "virtualSize"), virtualWidth, virtualHeight);
+        glUniform2f(glGetUniformLocation(programId, "imageScale"), header.imageWidth / virtualWidth, header.imageHeight / virtualHeight);
+        glUniform1f(glGetUniformLocation(programId, "tileSize"), header.tileSize);
+        glUniform1f(glGetUniformLocation(programId, "border"), header.border);
+        glUniform1f(glGetUniformLocation(programId, "atlasSize"), atlasPages * store->getPageSize());
+        glUniform1f(glGetUniformLocation(programId, "maxLevel"), store->getLevels() - 1);
+        // derivatives are feedbackScale times larger in the smaller feedback pass
+        glUniform1f(glGetUniformLocation(programId, "lodBias"), feedback ? -log2f(feedbackScale) : 0.0f);
+    }
+
+    void destroy() {
+        // the pool finishes the loads in flight before its threads stop
+        pool.reset();
+        loads.clear();
+        atlas.reset();
+        indirection.reset();
+        feedbackBuffers[0].reset();
+        feedbackBuffers[1].reset();
+        if (feedbackFramebuffer != 0) {
+            glDeleteFramebuffers(1, &feedbackFramebuffer);
+            glDeleteRenderbuffers(2, feedbackRenderbuffers);
+            feedbackFramebuffer = 0;
+        }
+        feedbackWidth = 0;
+        feedbackHeight = 0;
+        feedbackPasses = 0;
+        pages.clear();
+        residentPages.clear();
+        store.reset();
+    }
+
+    int getResidentPages() const { return residentPages.size(); }
+    int getPageCount() const { return pages.size(); }
+    int getLoadsInFlight() const { return loads.size(); }
+    long getUploads() const { return uploads; }
+    long getEvictions() const { return evictions; }
+
+    // the GPU memory used by the atlas and the indirection texture, mip levels included
+    size_t getMemoryUsed() const {
+        size_t atlasSize = (size_t) atlasPages * store->getPageSize();
+        size_t indirectionSize = 0;
+        for (size_t level = 0; level < indirectionLevels.size(); level++) {
+            indirectionSize += indirectionLevels[level].size();
+        }
+        return atlasSize * atlasSize * 4 + indirectionSize;
+    }
+
+private:
+
+    // a page of the atlas and the tile it holds
+    struct Page {
+        Page() : key(0), lastUsed(0), used(false), pinned(false) {}
+        uint64_t key;
+        long lastUsed;
+        bool used;
+        bool pinned;
+    };
+
+    // a tile being read and decoded by a worker
+    struct Load {
+        uint64_t key;
+        std::shared_ptr<std::vector<unsigned char> > pixels;
+        std::future<bool> done;
+    };
+
+    // tiles requested by the feedback at most per frame, and in flight at once
+    static const int MAX_REQUESTS_PER_FRAME = 16;
+    static const int MAX_LOADS_IN_FLIGHT = 32;
+    // tiles copied into the atlas at most per frame, to keep frames smooth
+    static const int MAX_UPLOADS_PER_FRAME = 8;
+
+    int atlasPages;
+    int feedbackScale;
+    std::unique_ptr<TileStore> store;
+    std::unique_ptr<WorkerPool> pool;
+    gl::Texture atlas;
+    gl::Texture indirection;
+    std::vector<std::vector<unsigned char> > indirectionLevels;
+    std::vector<Page> pages;
+    std::unordered_map<uint64_t, int> residentPages;
+    std::vector<Load> loads;
+
+    GLuint feedbackFramebuffer;
+    GLint previousFramebuffer;
+    GLuint feedbackRenderbuffers[2];
+    gl::Buffer feedbackBuffers[2];
+    int feedbackWidth;
+    int feedbackHeight;
+    // the passes read back since the targets were created
+    long feedbackPasses;
+    int currentBuffer;
+
+    long frame;
+    bool indirectionDirty;
+    long uploads;
+    long evictions;
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    static uint64_t tileKey(int level, int x, int y) {
+        return ((uint64_t) level << 48) | ((uint64_t) y << 24) | (uint64_t) x;
+    }
+
+    static int keyLevel(uint64_t key) { return (int) (key >> 48); }
+    static int keyY(uint64_t key) { return (int) ((key >> 24) & 0xffffff); }
+    static int keyX(uint64_t key) { return (int) (key & 0xffffff); }
+
+    bool loadTile(int level, int x, int y, std::vector<unsigned char>& pixels) {
+        Tracer::Scope trace("load tile");
+        std::vector<unsigned char> data;
+        ImageDecoder decoder;
+        int pageSize = store->getPageSize();
+        if (!store->readTile(level, x, y, data) || !decoder.open(data.data(), data.size())
+                || decoder.getWidth() != pageSize || decoder.getHeight() != pageSize) {
+            return false;
+        }
+        pixels.resize((size_t) pageSize * pageSize * 4);
+        return decoder.decode(pixels.data(), 4, false);
+    }
+
+    void createFeedbackTargets(int width, int height) {
+        if (feedbackFramebuffer == 0) {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(2, feedbackRenderbuffers);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        size_t size = (size_t) width * height * 4 * sizeof(GLushort);
+        for (int i = 0; i < 2; i++) {
+            feedbackBuffers[i] = gl::Buffer::create(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        feedbackWidth = width;
+        feedbackHeight = height;
+        feedbackPasses = 0;
+    }
+
+    // marks the pages the feedback pass before the last one saw as used, and
+    // requests the tiles it wanted that are neither in memory nor on their
+    // way; the last pass may still be in flight on the GPU
+    void processFeedback() {
+        for (size_t i = 0; i < pages.size(); i++) {
+            pages[i].used = false;
+        }
+        if (feedbackPasses < 2) {
+            return;
+        }
+        size_t size = (size_t) feedbackWidth * feedbackHeight * 4 * sizeof(GLushort);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffers[1 - currentBuffer].getId());
+        const GLushort* texels = (const GLushort*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        std::vector<uint64_t> wanted;
+        for (int i = 0; texels != nullptr && i < feedbackWidth * feedbackHeight; i++) {
+            const GLushort* texel = texels + i * 4;
+            if (texel[3] != 0) {
+                wanted.push_back(tileKey(texel[2], texel[0], texel[1]));
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // the ancestors of the wanted tiles are wanted too, they stand in
+        // for them until they arrive; coarse tiles first, they cover more of
+        // the screen
+        std::sort(wanted.begin(), wanted.end(), [](uint64_t a, uint64_t b) { return a > b; });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        for (size_t i = 0, count = wanted.size(); i < count; i++) {
+            for (int level = keyLevel(wanted[i]) + 1; level < store->getLevels(); level++) {
+                int shift = level - keyLevel(wanted[i]);
+                wanted.push_back(tileKey(level, keyX(wanted[i]) >> shift, keyY(wanted[i]) >> shift));
+            }
+        }
+        std::sort(wanted.begin(), wanted.end(), [](uint64_t a, uint64_t b) { return a > b; });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        int requests = 0;
+        for (size_t i = 0; i < wanted.size(); i++) {
+            uint64_t key = wanted[i];
+            std::unordered_map<uint64_t, int>::iterator resident = residentPages.find(key + 1);
+            if (resident != residentPages.end()) {
+                pages[resident->second].used = true;
+                pages[resident->second].lastUsed = frame;
+            } else if (requests < MAX_REQUESTS_PER_FRAME && (int) loads.size() < MAX_LOADS_IN_FLIGHT
+                    && !loading(key) && keyLevel(key) < store->getLevels()
+                    && keyX(key) < store->getTilesX(keyLevel(key)) && keyY(key) < store->getTilesY(keyLevel(key))
+                    && store->hasTile(keyLevel(key), keyX(key), keyY(key))) {
+                requestTile(key);
+                requests++;
+            }
+        }
+    }
+
+    bool loading(uint64_t key) const {
+        for (size_t i = 0; i < loads.size(); i++) {
+            if (loads[i].key == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void requestTile(uint64_t key) {
+        Load load;
+        load.key = key;
+        load.pixels.reset(new std::vector<unsigned char>());
+        std::shared_ptr<std::vector<unsigned char> > pixels = load.pixels;
+        load.done = pool->submit([this, key, pixels]() {
+            return loadTile(keyLevel(key), keyX(key), keyY(key), *pixels);
+        });
+        loads.push_back(std::move(load));
+    }
+
+    // copies the tiles the workers are done with into the atlas
+    void completeLoads() {
+        int uploaded = 0;
+        for (size_t i = 0; i < loads.size() && uploaded < MAX_UPLOADS_PER_FRAME; ) {
+            Load& load = loads[i];
+            if (load.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                i++;
+                continue;
+            }
+            int page = -1;
+            if (load.done.get()) {
+                page = allocatePage();
+            }
+            if (page >= 0) {
+                uploadTile(page, load.key, *load.pixels);
+                uploaded++;
+            }
+            // without a page to spare the tile is dropped, the feedback asks again
+            loads.erase(loads.begin() + i);
+        }
+    }
+
+    // a free page, or the least recently used one that the last frame did not need
+    int allocatePage() {
+        int best = -1;
+        for (size_t i = 0; i < pages.size(); i++) {
+            const Page& page = pages[i];
+            if (page.key == 0 && !page.pinned) {
+                return i;
+            }
+            if (!page.pinned && !page.used && (best < 0 || page.lastUsed < pages[best].lastUsed)) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            residentPages.erase(pages[best].key);
+            pages[best].key = 0;
+            evictions++;
+            indirectionDirty = true;
+        }
+        return best;
+    }
+
+    void uploadTile(int page, uint64_t key, const std::vector<unsigned char>& pixels) {
+        int pageSize = store->getPageSize();
+        atlas.bind();
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (page % atlasPages) * pageSize, (page / atlasPages) * pageSize,
+            pageSize, pageSize, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        // level 0 tile (0, 0) has key 0, which also marks free pages: shift by one
+        pages[page].key = key + 1;
+        pages[page].lastUsed = frame;
+        pages[page].used = true;
+        residentPages[key + 1] = page;
+        uploads++;
+        indirectionDirty = true;
+    }
+
+    // every tile points at its own page when it is in memory, at the page its
+    // parent points at otherwise
+    void buildIndirection() {
+        int levels = store->getLevels();
+        indirection.bind();
+        for (int level = levels - 1; level >= 0; level--) {
+            int tilesX = store->getTilesX(level);
+            int tilesY = store->getTilesY(level);
+            std::vector<unsigned char>& entries = indirectionLevels[level];
+            for (int y = 0; y < tilesY; y++) {
+                for (int x = 0; x < tilesX; x++) {
+                    unsigned char* entry = &entries[((size_t) y * tilesX + x) * 4];
+                    std::unordered_map<uint64_t, int>::iterator resident = residentPages.find(tileKey(level, x, y) + 1);
+                    if (resident != residentPages.end()) {
+                        entry[0] = resident->second % atlasPages;
+                        entry[1] = resident->second / atlasPages;
+                        entry[2] = level;
+                        entry[3] = 255;
+                    } else if (level + 1 < levels) {
+                        int parentX = std::min(x / 2, store->getTilesX(level + 1) - 1);
+                        int parentY = std::min(y / 2, store->getTilesY(level + 1) - 1);
+                        memcpy(entry, &indirectionLevels[level + 1][((size_t) parentY * store->getTilesX(level + 1) + parentX) * 4], 4);
+                    } else {
+                        memset(entry, 0, 4);
+                    }
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tilesX, tilesY, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+        }
+        indirectionDirty = false;
+    }
+};
+
+#endif
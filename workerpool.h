@@ -0,0 +1,93 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+#include "tracer.h"
+
+/*
+ * A fixed set of threads running the tasks submitted to them in order. Each
+ * submission returns a future for the task's result, so that the GL thread
+ * can keep doing its own work and pick the results up as they arrive.
+ * Tasks must not touch GL: only the thread owning the context may.
+ */
+
+class WorkerPool {
+
+public:
+
+    // threadCount 0 uses one thread per hardware thread
+    explicit WorkerPool(int threadCount = 0) : stopping(false) {
+        if (threadCount <= 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&WorkerPool::run, this));
+        }
+    }
+
+    // runs the tasks still queued, then stops the threads
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    template <class Task>
+    std::future<typename std::result_of<Task()>::type> submit(Task task) {
+        typedef typename std::result_of<Task()>::type Result;
+        // std::function needs a copyable target, which packaged_task is not
+        std::shared_ptr<std::packaged_task<Result()> > packaged(new std::packaged_task<Result()>(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([packaged]() { (*packaged)(); });
+        }
+        condition.notify_one();
+        return result;
+    }
+
+    int getThreadCount() const { return (int) workers.size(); }
+
+private:
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void run() {
+        Tracer::instance().setThreadName("worker");
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            Tracer::Scope trace("task");
+            task();
+        }
+    }
+};
+
+#endif